@@ -0,0 +1,128 @@
+/**
+ * @file FragmentSendPipeline.hpp Asynchronous, per destination fragment
+ * sending with dedicated sender threads.
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_FRAGMENTSENDPIPELINE_HPP_
+#define DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_FRAGMENTSENDPIPELINE_HPP_
+
+#include "datahandlinglibs/utils/LatencyHistogram.hpp"
+
+#include "daqdataformats/Fragment.hpp"
+#include "daqdataformats/SourceID.hpp"
+#include "iomanager/IOManager.hpp"
+#include "opmonlib/MonitorableObject.hpp"
+
+#include <folly/concurrency/UnboundedQueue.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+
+namespace dunedaq {
+namespace datahandlinglibs {
+
+/** FragmentSendPipeline usage:
+ *
+ *   FragmentSendPipeline pipeline(sourceid, std::chrono::milliseconds(10), 1024, on_sent);
+ *   pipeline.start();
+ *   pipeline.send(std::move(fragment), "trb_connection"); // returns immediately while the queue has room
+ *   pipeline.stop();                                      // drains the queues and joins the senders
+ *   pipeline.clear_destinations();                        // e.g. at scrap, before a new configuration
+ *
+ * Every destination gets its own lock-free queue and sender thread, so a slow downstream
+ * only delays fragments going to that destination, and the threads that build fragments never
+ * block on a send. Once max_queue_depth fragments are queued for a destination, further ones
+ * are sent on the calling thread, so a stalled destination throttles the producers instead of
+ * piling up fragments in memory. The on_sent callback receives the storage location of every fragment once
+ * its send attempt finished, which allows recycling buffers the fragments were viewing.
+ */
+class FragmentSendPipeline : public opmonlib::MonitorableObject
+{
+public:
+  using FragmentPtr = std::unique_ptr<daqdataformats::Fragment>;
+  using OnSentCallback = std::function<void(const void*)>;
+
+  FragmentSendPipeline(daqdataformats::SourceID sourceid,
+                       std::chrono::milliseconds send_timeout,
+                       std::size_t max_queue_depth,
+                       OnSentCallback on_sent = nullptr);
+
+  ~FragmentSendPipeline();
+
+  FragmentSendPipeline(const FragmentSendPipeline&) = delete;            ///< FragmentSendPipeline is not copy-constructible
+  FragmentSendPipeline& operator=(const FragmentSendPipeline&) = delete; ///< FragmentSendPipeline is not copy-assginable
+  FragmentSendPipeline(FragmentSendPipeline&&) = delete;                 ///< FragmentSendPipeline is not move-constructible
+  FragmentSendPipeline& operator=(FragmentSendPipeline&&) = delete;      ///< FragmentSendPipeline is not move-assignable
+
+  // Set up a destination (sender handle, queue and thread) ahead of the first fragment sent to it.
+  // False if there is no sender for it.
+  bool add_destination(const std::string& destination);
+
+  // Start accepting fragments
+  void start();
+
+  // Stop accepting fragments, send what is queued and join the sender threads
+  void stop();
+
+  // Stop and forget all destinations and their sender handles
+  void clear_destinations();
+
+  bool is_running() const { return m_running.load(); }
+
+  // Queue a fragment for sending, or send it right away if the destination queue is full.
+  // False if the destination is unknown or the direct send failed, on_sent is called in any case.
+  bool send(FragmentPtr fragment, const std::string& destination);
+
+protected:
+  void generate_opmon_data() override;
+
+private:
+  struct QueuedFragment
+  {
+    FragmentPtr fragment;
+    std::chrono::steady_clock::time_point enqueued;
+  };
+
+  struct Destination
+  {
+    std::string uid;
+    std::shared_ptr<iomanager::SenderConcept<FragmentPtr>> sender;
+    folly::UMPSCQueue<QueuedFragment, true> queue;
+    std::thread worker;
+    std::atomic<bool> running{ false };
+    std::atomic<uint64_t> queue_depth{ 0 };      // NOLINT(build/unsigned)
+    std::atomic<uint64_t> num_sent{ 0 };         // NOLINT(build/unsigned)
+    std::atomic<uint64_t> num_send_failed{ 0 };  // NOLINT(build/unsigned)
+    std::atomic<uint64_t> num_sent_directly{ 0 }; // NOLINT(build/unsigned)
+    LatencyHistogram send_latency;
+  };
+
+  // nullptr if there is no sender for the destination
+  Destination* get_destination(const std::string& destination);
+  void start_worker(Destination& dest);
+  bool send_now(Destination& dest, FragmentPtr fragment);
+  void run_sender(Destination& dest);
+
+  daqdataformats::SourceID m_sourceid;
+  std::chrono::milliseconds m_send_timeout;
+  std::size_t m_max_queue_depth;
+  OnSentCallback m_on_sent;
+  std::atomic<bool> m_running{ false };
+  std::map<std::string, std::unique_ptr<Destination>> m_destinations;
+  std::shared_mutex m_destinations_mutex;
+};
+
+} // namespace datahandlinglibs
+} // namespace dunedaq
+
+#endif // DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_FRAGMENTSENDPIPELINE_HPP_
@@ -58,6 +58,7 @@ public:
   void do_start(const nlohmann::json& /*args*/);
   void do_stop(const nlohmann::json& /*args*/);
   void do_record(const nlohmann::json& /*args*/);
+  void do_dump(const nlohmann::json& /*args*/);
 
   std::string get_dlh_name() { return m_name; }
 
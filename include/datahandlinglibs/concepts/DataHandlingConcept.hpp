@@ -31,6 +31,7 @@ public:
   virtual void start(const nlohmann::json& args) = 0;
   virtual void stop(const nlohmann::json& args) = 0;
   virtual void record(const nlohmann::json& args) = 0;
+  virtual void dump(const nlohmann::json& args) = 0;
 
   //! Function that will be run in its own thread to read the raw packets from the connection and add them to the LB
   virtual void run_consume() = 0;
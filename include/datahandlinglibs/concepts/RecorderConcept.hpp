@@ -14,6 +14,7 @@
 #include "datahandlinglibs/utils/BufferedFileWriter.hpp"
 #include "utilities/ReusableThread.hpp"
 #include "appmodel/DataRecorderModule.hpp"
+#include "opmonlib/MonitorableObject.hpp"
 
 #include <atomic>
 #include <fstream>
@@ -25,7 +26,7 @@
 namespace dunedaq {
 namespace datahandlinglibs {
 
-class RecorderConcept
+class RecorderConcept : public opmonlib::MonitorableObject
 {
 public:
   RecorderConcept() {}
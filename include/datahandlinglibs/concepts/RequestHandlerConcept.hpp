@@ -43,6 +43,8 @@ public:
   virtual void start(const nlohmann::json& args) = 0;
   virtual void stop(const nlohmann::json& args) = 0;
   virtual void record(const nlohmann::json& args) = 0;
+  //! Write the data of a timestamp window that is already in the latency buffer to disk
+  virtual void dump(const nlohmann::json& args) = 0;
 
   //! Check if cleanup is necessary and execute it if necessary
   virtual void cleanup_check() = 0;
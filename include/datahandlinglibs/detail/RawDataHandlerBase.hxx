@@ -13,6 +13,7 @@ RawDataHandlerBase::RawDataHandlerBase(const std::string& name)
   register_command("start", &RawDataHandlerBase::do_start);
   register_command("stop_trigger_sources", &RawDataHandlerBase::do_stop);
   register_command("record", &RawDataHandlerBase::do_record);
+  register_command("dump", &RawDataHandlerBase::do_dump);
 */
 }
 
@@ -88,6 +89,14 @@ RawDataHandlerBase::do_record(const nlohmann::json& args)
   TLOG_DEBUG(dunedaq::datahandlinglibs::logging::TLVL_ENTER_EXIT_METHODS) << get_dlh_name() << ": Exiting do_issue_recording() method";
 }
 
+void
+RawDataHandlerBase::do_dump(const nlohmann::json& args)
+{
+  TLOG_DEBUG(dunedaq::datahandlinglibs::logging::TLVL_ENTER_EXIT_METHODS) << get_dlh_name() << ": Entering do_dump() method";
+  m_readout_impl->dump(args);
+  TLOG_DEBUG(dunedaq::datahandlinglibs::logging::TLVL_ENTER_EXIT_METHODS) << get_dlh_name() << ": Exiting do_dump() method";
+}
+
 } // namespace datahandlinglibs
 } // namespace dunedaq
 
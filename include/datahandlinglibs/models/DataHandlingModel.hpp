@@ -122,6 +122,12 @@ public:
     m_request_handler_impl->record(args); 
   }
 
+  // Dump function: invokes request handler's dump implementation
+  void dump(const nlohmann::json& args) override
+  {
+    m_request_handler_impl->dump(args);
+  }
+
   // Opmon get_info call implementation
   //void get_info(opmonlib::InfoCollector& ci, int level);
 
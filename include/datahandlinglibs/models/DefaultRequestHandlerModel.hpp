@@ -10,14 +10,21 @@
 #define DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_MODELS_DEFAULTREQUESTHANDLERMODEL_HPP_
 
 #include "datahandlinglibs/DataHandlingIssues.hpp"
+#include "datahandlinglibs/FragmentSendPipeline.hpp"
 #include "datahandlinglibs/concepts/RequestHandlerConcept.hpp"
+#include "datahandlinglibs/utils/BufferCopy.hpp"
 #include "datahandlinglibs/utils/BufferedFileWriter.hpp"
+#include "datahandlinglibs/utils/FragmentBufferPool.hpp"
+#include "datahandlinglibs/utils/LatencyHistogram.hpp"
+#include "datahandlinglibs/utils/ResponseCache.hpp"
+#include "datahandlinglibs/utils/ThreadAffinity.hpp"
 #include "utilities/ReusableThread.hpp"
 
 #include "datahandlinglibs/opmon/datahandling_info.pb.h"
 
 #include "confmodel/DaqModule.hpp"
 #include "confmodel/Connection.hpp"
+#include "confmodel/NetworkConnection.hpp"
 #include "appmodel/DataHandlerModule.hpp"
 #include "appmodel/DataHandlerConf.hpp"
 #include "appmodel/RequestHandler.hpp"
@@ -38,9 +45,11 @@
 #include <folly/concurrency/UnboundedQueue.h>
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <deque>
+#include <fstream>
 #include <functional>
 #include <future>
 #include <iomanip>
@@ -50,9 +59,12 @@
 #include <queue>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
+#include <xmmintrin.h>
+
 using dunedaq::datahandlinglibs::logging::TLVL_HOUSEKEEPING;
 using dunedaq::datahandlinglibs::logging::TLVL_QUEUE_PUSH;
 using dunedaq::datahandlinglibs::logging::TLVL_WORK_STEPS;
@@ -78,6 +90,18 @@ get_frame_iterator_timestamp(T iter)
   return iter->get_timestamp();
 }
 
+// Whether a latency buffer can tell how many elements precede one of its iterators,
+// which allows cutting it at a given timestamp with a single bulk pop
+template<class LB, class = void>
+struct has_elements_before : std::false_type
+{};
+
+template<class LB>
+struct has_elements_before<
+  LB,
+  std::void_t<decltype(std::declval<LB&>().elements_before(std::declval<typename LB::Iterator&>()))>>
+  : std::true_type
+{};
 
 template<class ReadoutType, class LatencyBufferType>
 class DefaultRequestHandlerModel : public RequestHandlerConcept<ReadoutType, LatencyBufferType>
@@ -119,13 +143,48 @@ public:
   struct RequestElement
   {
     RequestElement(const dfmessages::DataRequest& data_request,
-                   const std::chrono::time_point<std::chrono::high_resolution_clock>& tp_value)
+                   const std::chrono::time_point<std::chrono::high_resolution_clock>& tp_value,
+                   uint64_t lease = s_no_retention_lease) // NOLINT(build/unsigned)
       : request(data_request)
       , start_time(tp_value)
+      , lease_id(lease)
     {}
 
     dfmessages::DataRequest request;
     std::chrono::time_point<std::chrono::high_resolution_clock> start_time;
+    uint64_t lease_id; // Retention lease keeping the window in the buffer while waiting // NOLINT(build/unsigned)
+  };
+
+  // A timestamp below which cleanup must not remove data, held by an ongoing operation
+  struct RetentionLease
+  {
+    uint64_t timestamp; // NOLINT(build/unsigned)
+    std::chrono::time_point<std::chrono::steady_clock> acquired;
+    std::chrono::milliseconds max_hold; // The lease stops holding back cleanup after this long. 0 means never.
+  };
+  static constexpr uint64_t s_no_retention_lease = std::numeric_limits<uint64_t>::max(); // NOLINT(build/unsigned)
+
+  // What a recording does when it falls further behind the newest data than the lag budget
+  enum RecordingLagPolicy
+  {
+    kBlock = 0, // Hold back cleanup until the data is written, even if the LB overflows
+    kSkip       // Skip ahead and note the gap in <output file>.gaps
+  };
+
+  // Stages of a data request that are timed individually
+  enum RequestStage
+  {
+    kQueueWait = 0,   // Waiting for a free request handler thread
+    kCleanupWait,     // Waiting for an ongoing latency buffer cleanup to finish
+    kLowerBound,      // Looking up the start of the window in the latency buffer
+    kPieceExtraction, // Collecting the fragment pieces of the window
+    kFragmentBuild,   // Copying the pieces into the fragment
+    kSend,            // Sending the fragment
+    kNumRequestStages
+  };
+
+  static constexpr std::array<const char*, kNumRequestStages> s_request_stage_names = {
+    "queue_wait", "cleanup_wait", "lower_bound", "piece_extraction", "fragment_build", "send"
   };
 
   // Default configuration mechanism
@@ -143,6 +202,9 @@ public:
   // Raw data recording implementation
   void record(const nlohmann::json& args) override;
 
+  // Writes a window already in the LB to disk. Arguments: window_begin, window_end and optionally output_file.
+  void dump(const nlohmann::json& args) override;
+
   // A function that determines if a cleanup request should be issued based on LB occupancy
   void cleanup_check() override;
   
@@ -177,6 +239,13 @@ protected:
     return fh;
   }
 
+  // Timestamp ticks covered by one latency buffer element, computed once per element type. Can be 0.
+  static uint64_t element_ticks() // NOLINT(build/unsigned)
+  {
+    static const uint64_t ticks = ReadoutType::expected_tick_difference * ReadoutType().get_num_frames(); // NOLINT(build/unsigned)
+    return ticks;
+  }
+
   // Helper function that creates and empty fragment.
   std::unique_ptr<daqdataformats::Fragment> create_empty_fragment(const dfmessages::DataRequest& dr);
 
@@ -198,6 +267,39 @@ protected:
     }
   }
 
+  // Helper function that creates a fragment from pieces, using a pooled buffer when possible
+  std::unique_ptr<daqdataformats::Fragment> build_fragment(const std::vector<std::pair<void*, size_t>>& frag_pieces,
+                                                           daqdataformats::FragmentHeader& frag_header);
+
+  // Copy the pieces back to back starting at dest, with streaming stores if requested
+  static void copy_pieces(char* dest, const std::vector<std::pair<void*, size_t>>& frag_pieces, bool streaming_copy);
+
+  // Copy the pieces back to back starting at dest, splitting the work among the idle request handler threads
+  void parallel_copy_pieces(char* dest,
+                            const std::vector<std::pair<void*, size_t>>& frag_pieces,
+                            size_t payload_size,
+                            bool streaming_copy);
+
+  // Give a fragment's storage back to the pool, if it was borrowed from it
+  void release_fragment_buffer(const void* storage);
+
+  // Lock-free update of a running minimum/maximum
+  static void update_min(std::atomic<int>& current, int value)
+  {
+    int old = current.load();
+    while (value < old && !current.compare_exchange_weak(old, value)) {
+    }
+  }
+  static void update_max(std::atomic<int>& current, int value)
+  {
+    int old = current.load();
+    while (value > old && !current.compare_exchange_weak(old, value)) {
+    }
+  }
+
+  // Names the request handler pool threads and pins them to m_request_handler_affinity
+  void setup_request_handler_threads();
+
   // Cleanup thread's work function. Runs the cleanup() routine
   void periodic_cleanups();
 
@@ -207,6 +309,60 @@ protected:
   // LB cleanup implementation
   void cleanup();
 
+  // Removes the elements older than m_retention_ticks with respect to the newest element
+  void retention_cleanup();
+
+  // Retention leases: data at or after a leased timestamp is kept in the LB until the lease is released
+  uint64_t acquire_retention_lease(uint64_t timestamp, // NOLINT(build/unsigned)
+                                   std::chrono::milliseconds max_hold = std::chrono::milliseconds(0));
+  void update_retention_lease(uint64_t lease_id, uint64_t timestamp); // NOLINT(build/unsigned)
+  void release_retention_lease(uint64_t lease_id);                 // NOLINT(build/unsigned)
+
+  // Oldest timestamp that cleanup may not remove, given the ongoing recording and the retention leases
+  uint64_t get_cleanup_floor(); // NOLINT(build/unsigned)
+
+  // Reads the window and output file of a dump command. Reports an error and returns false if no dump can be started.
+  bool parse_dump_args(const nlohmann::json& args,
+                       uint64_t& window_begin, // NOLINT(build/unsigned)
+                       uint64_t& window_end,   // NOLINT(build/unsigned)
+                       std::string& dump_file);
+
+  // With the skip policy, the timestamp a recording that fell behind by more than the lag budget continues from.
+  // 0 if the recording can continue where it is.
+  uint64_t recording_skip_target(); // NOLINT(build/unsigned)
+  void mark_recording_gap(uint64_t from, uint64_t to); // NOLINT(build/unsigned)
+
+  // Progress of a dump, as seen by opmon
+  void start_dump_progress();
+  void update_dump_progress(size_t bytes, double progress, std::chrono::steady_clock::time_point start);
+
+  // Puts a request aside until its data arrives or it times out
+  void add_waiting_request(const dfmessages::DataRequest& dr);
+
+  // Post a request to the request handler pool. The retention lease, if any, is released once it was served.
+  void post_request(dfmessages::DataRequest datarequest, bool is_retry, uint64_t lease_id); // NOLINT(build/unsigned)
+
+  // Sends a fragment to the given destination and returns its buffer to the pool
+  bool send_fragment(std::unique_ptr<daqdataformats::Fragment> fragment, const std::string& destination);
+
+  // Answer a request from the response cache. False if it is not cached.
+  bool send_cached_response(const dfmessages::DataRequest& dr);
+
+  // Keep a copy of a final response for duplicates and retries of the same request
+  void cache_response(const dfmessages::DataRequest& dr, const RequestResult& result);
+
+  // Extract all data since the periodic transmission cursor as a single fragment and move the cursor.
+  // Returns nullptr if there is nothing new.
+  std::unique_ptr<daqdataformats::Fragment> extract_periodic_batch();
+
+  // Rough size of the response to a data request, based on the window length
+  size_t estimate_response_size(const dfmessages::DataRequest& dr);
+
+  // Responds to a request with a sequence of fragments covering consecutive sub-windows. All of them carry the
+  // trigger and sequence number of the request, they are told apart by the window_begin and window_end of their
+  // header, which hold the sub-window. Only used when the consumer declared it merges such fragments.
+  void stream_response(const dfmessages::DataRequest& dr, bool is_retry);
+
   // Function that checks delayed requests that are waiting for not yet present data in LB
   void check_waiting_requests();
 
@@ -215,6 +371,12 @@ protected:
                                                             uint64_t end_win_ts,
                                                             RequestResult& rres);
 
+  // Function that adds the frames of an aggregated element (e.g.: superchunk) that fall into the window
+  void add_partial_element_pieces(RDT* element,
+                                  uint64_t start_win_ts,
+                                  uint64_t end_win_ts,
+                                  std::vector<std::pair<void*, size_t>>& frag_pieces);
+
   // Override data_request functionality
   RequestResult data_request(dfmessages::DataRequest dr) override;
 
@@ -244,9 +406,22 @@ protected:
   std::vector<RequestElement> m_waiting_requests;
   std::mutex m_waiting_requests_lock;
 
+  // Pre-faulted fragment buffers, only used if all Fragment outputs are network connections
+  std::unique_ptr<FragmentBufferPool> m_fragment_buffer_pool;
+
+  // Retention leases held by ongoing requests
+  std::map<uint64_t, RetentionLease> m_retention_leases; // NOLINT(build/unsigned)
+  std::mutex m_retention_leases_lock;
+  uint64_t m_next_retention_lease_id = 0; // NOLINT(build/unsigned)
+
+  // Asynchronous sending of responses, only used if m_async_send is set
+  std::shared_ptr<FragmentSendPipeline> m_fragment_send_pipeline;
+  ResponseCache m_response_cache;
+
   // Data extractor threads pool and corresponding requests
   std::unique_ptr<boost::asio::thread_pool> m_request_handler_thread_pool;
   size_t m_num_request_handling_threads = 0;
+  cpu_set_t m_request_handler_affinity; // Empty mask: threads are not pinned
 
   // Error registry
   std::unique_ptr<FrameErrorRegistry>& m_error_registry;
@@ -269,11 +444,40 @@ protected:
   uint16_t m_detid;
   std::string m_output_file;
   size_t m_stream_buffer_size = 0;
+  std::string m_compression_algorithm = "None";
+  bool m_use_o_direct = true;
   bool m_recording_configured = false;
   bool m_warn_on_timeout = true; // Whether to warn when a request times out
   bool m_warn_about_empty_buffer = true; // Whether to warn about an empty buffer when processing a request
   uint32_t m_periodic_data_transmission_ms = 0;
+  uint64_t m_periodic_cursor_ts = std::numeric_limits<uint64_t>::max(); // Start of the next periodic batch // NOLINT(build/unsigned)
+  uint64_t m_periodic_batch_number = 0;                                   // NOLINT(build/unsigned)
+  daqdataformats::run_number_t m_run_number = 0;
   std::vector<std::string> m_frag_out_conn_ids;
+  size_t m_fragment_pool_max_bytes = 0; // Memory budget of the fragment buffer pool. 0 disables the pool.
+  uint64_t m_retention_ticks = 0;       // Amount of data to keep in DAQ ticks. 0 keeps the percentage based cleanup only. // NOLINT(build/unsigned)
+  size_t m_prefetch_distance = 4;       // Number of elements prefetched ahead while walking a window. 0 disables.
+  size_t m_nt_copy_threshold_bytes = 0; // Fragments above this size are built with streaming stores. 0 disables.
+  size_t m_parallel_copy_threshold_bytes = 0; // Fragments above this size are assembled by several threads. 0 disables.
+  size_t m_parallel_copy_chunk_bytes = 4 * 1024 * 1024; // Smallest amount of data copied by one thread
+  std::string m_request_handler_cpus;   // CPU list ("0-3,8") for the request handler threads. Overrides the LB NUMA node.
+  uint32_t m_max_request_hold_ms = 0;   // How long a waiting request may hold back cleanup. 0 disables the hold. // NOLINT(build/unsigned)
+  bool m_periodic_batch_transmission = false; // Built-in periodic_data_transmission(): send new data as one fragment
+  std::string m_periodic_destination;         // Destination of the periodic batches, "periodic_destination" of start. Nothing is sent while empty.
+  size_t m_response_cache_entries = 0;           // Number of responses kept for duplicate requests. 0 disables the cache.
+                                                 // When enabled, every final response is copied into the cache.
+  size_t m_response_cache_max_bytes = 256 * 1024 * 1024;
+  uint32_t m_response_cache_ttl_ms = 1000;       // NOLINT(build/unsigned)
+  size_t m_recording_index_interval_bytes = 0;   // Distance between timestamp index entries of recordings. 0 disables.
+  size_t m_recording_staging_buffers = 0;       // Recording staging buffers written by a background thread. 0 disables.
+  RecordingLagPolicy m_recording_lag_policy = kBlock;
+  uint64_t m_recording_max_lag_ticks = 0;        // Lag budget of the skip policy in ticks. 0: no limit. // NOLINT(build/unsigned)
+  size_t m_recording_max_lag_bytes = 0;          // Lag budget of the skip policy in bytes. 0: no limit.
+  bool m_async_send = false;            // Hand responses over to per-destination sender threads
+  size_t m_async_send_max_queue_depth = 1024; // Fragments queued per destination, more are sent by the request thread
+  size_t m_stream_response_threshold_bytes = 0; // Responses above this size are sent in chunks of this size. 0 disables.
+  bool m_stream_response_consumer_support = false; // The consumer accepts sub-window fragments, see stream_response()
+  uint32_t m_stream_response_max_hold_ms = 10000; // How long a streamed response may hold back cleanup // NOLINT(build/unsigned)
 
   // Stats
   std::atomic<int> m_pop_counter;
@@ -293,8 +497,23 @@ protected:
   std::atomic<int> m_response_time_max{ 0 };
   std::atomic<int> m_payloads_written{ 0 };
   std::atomic<int> m_bytes_written{ 0 };
+  std::atomic<bool> m_dumping{ false };
+  std::atomic<uint64_t> m_dump_bytes{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<double> m_dump_progress{ 0 };
+  std::atomic<double> m_dump_rate{ 0 };
+  std::atomic<uint64_t> m_num_recording_skips{ 0 };   // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_recording_ticks_skipped{ 0 }; // NOLINT(build/unsigned)
   std::atomic<uint64_t> m_num_periodic_sent{ 0 };  // NOLINT(build/unsigned)
   std::atomic<uint64_t> m_num_periodic_send_failed{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_num_fragment_pool_hits{ 0 };   // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_num_fragment_pool_misses{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_num_requests_streamed{ 0 };    // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_num_stream_chunks_sent{ 0 };   // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_num_parallel_assemblies{ 0 };  // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_num_request_holds_expired{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_num_response_cache_hits{ 0 };   // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_num_response_cache_misses{ 0 }; // NOLINT(build/unsigned)
+  std::array<LatencyHistogram, kNumRequestStages> m_request_stage_latency;
 	
   // std::atomic<int> m_avg_req_count{ 0 }; // for opmon, later
   // std::atomic<int> m_avg_resp_time{ 0 };
@@ -311,6 +311,9 @@ struct IterableQueueModel : public LatencyBufferConcept<T>
     return Iterator(*this, std::numeric_limits<uint32_t>::max()); // NOLINT(build/unsigned)
   }
 
+  // Number of elements between the front of the queue and the given iterator. All of them if it is not good.
+  std::size_t elements_before(Iterator& iter);
+
 protected:
   virtual void generate_opmon_data() override;
 
@@ -14,6 +14,7 @@
 #include "datahandlinglibs/ReadoutTypes.hpp"
 #include "datahandlinglibs/concepts/RecorderConcept.hpp"
 #include "datahandlinglibs/utils/BufferedFileWriter.hpp"
+#include "datahandlinglibs/utils/DoubleBufferedFileWriter.hpp"
 #include "utilities/ReusableThread.hpp"
 
 #include "datahandlinglibs/opmon/datahandling_info.pb.h"
@@ -23,10 +24,12 @@
 #include "appmodel/DataRecorderModule.hpp"
 #include "appmodel/DataRecorderConf.hpp"
 #include <atomic>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <utility>
 
 namespace dunedaq {
 namespace datahandlinglibs {
@@ -43,16 +46,26 @@ public:
   void init(const appmodel::DataRecorderModule* conf) override;
   //  void get_info(opmonlib::InfoCollector& ci, int /* level */) override;
   void do_conf(const nlohmann::json& /*args*/) override;
-  void do_scrap(const nlohmann::json& /*args*/) override { m_buffered_writer.close(); }
+  void do_scrap(const nlohmann::json& /*args*/) override
+  {
+    m_buffered_writer.close();
+    m_batch_writer.close();
+  }
   void do_start(const nlohmann::json& /* args */) override;
   void do_stop(const nlohmann::json& /* args */) override;
 
 protected:
   virtual void generate_opmon_data() override;
 
+  size_t m_index_interval_bytes = 0; // Distance between timestamp index entries of the recording. 0 disables.
+  // Elements drained per wake-up and written as one batch by a background thread. 0 writes element by element
+  // through the buffered writer. Only used without compression.
+  size_t m_batch_elements = 0;
+
 private:
   // The work that the worker thread does
   void do_work();
+  void do_batched_work();
 
   // Queue
   using source_t = dunedaq::iomanager::ReceiverConcept<ReadoutType>;
@@ -66,6 +79,8 @@ private:
   bool m_use_o_direct;
 
   BufferedFileWriter<> m_buffered_writer;
+  DoubleBufferedFileWriter m_batch_writer;
+  bool m_batched = false;
 
   // Threading
   utilities::ReusableThread m_work_thread;
@@ -17,6 +17,7 @@
 #include "confmodel/GeoId.hpp"
 
 #include "datahandlinglibs/DataHandlingIssues.hpp"
+#include "datahandlinglibs/DataMoveCallbackRegistry.hpp"
 #include "datahandlinglibs/concepts/SourceEmulatorConcept.hpp"
 #include "datahandlinglibs/utils/ErrorBitGenerator.hpp"
 #include "datahandlinglibs/utils/FileSourceBuffer.hpp"
@@ -26,6 +27,7 @@
 #include "datahandlinglibs/opmon/datahandling_info.pb.h"
 
 #include "unistd.h"
+#include <algorithm>
 #include <chrono>
 #include <functional>
 #include <memory>
@@ -107,6 +109,9 @@ protected:
   void run_produce();
   virtual void generate_opmon_data() override;
 
+  bool m_use_huge_pages = false; // Ask for huge pages backing the mapped input file
+  uint16_t m_batch_ticks = 1;     // NOLINT(build/unsigned) Ticks generated and sent per rate limiter period
+
 private:
   // Constuctor params
   std::atomic<bool>& m_run_marker;
@@ -129,6 +134,9 @@ private:
   std::chrono::milliseconds m_raw_sender_timeout_ms;
   using raw_sender_ct = iomanager::SenderConcept<ReadoutType>;
   std::shared_ptr<raw_sender_ct> m_raw_data_sender;
+  std::string m_raw_data_connection_name;
+  // Consumer callback, when the connection is a "cb_" one registered by a DataHandlingModel
+  std::shared_ptr<std::function<void(ReadoutType&&)>> m_raw_data_callback;
 
   bool m_sender_is_set = false;
   //using module_conf_t = dunedaq::datahandlinglibs::sourceemulatorconfig::Conf;
@@ -11,7 +11,13 @@
 #define DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_MODELS_ZEROCOPYRECORDINGREQUESTHANDLERMODEL_HPP_
 
 #include "datahandlinglibs/models/DefaultRequestHandlerModel.hpp"
+#include "datahandlinglibs/utils/StripedFile.hpp"
+#include "datahandlinglibs/utils/UringFileWriter.hpp"
 #include <memory>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
 
 namespace dunedaq {
 namespace datahandlinglibs {
@@ -34,12 +40,36 @@ public:
   // Special configuration that checks LB alignment and O_DIRECT flag on output file
   void conf(const appmodel::DataHandlerModule* conf) override;
 
+  // Closes the output files opened at conf
+  void scrap(const nlohmann::json& args) override;
+
   // Special record command that writes to files from memory aligned LBs
   void record(const nlohmann::json& args) override;
 
+  // Dump of a window in the LB, written with O_DIRECT straight from the LB memory
+  void dump(const nlohmann::json& args) override;
+
+protected:
+  // Number of chunk writes kept in flight with io_uring, 0 writes synchronously.
+  // A record or dump command can override it with its "uring_queue_depth" argument.
+  unsigned m_uring_queue_depth = UringFileWriter::s_default_queue_depth;
+
 private:
-  int m_fd;
+  // Set the file status flags of all output files, e.g. to toggle O_DIRECT
+  void set_file_flags(int flags);
+
+  void close_files();
+
+  // Queue depth requested by a record or dump command, m_uring_queue_depth if none
+  unsigned uring_queue_depth(const nlohmann::json& args) const;
+
+  // With the skip lag policy, move the write pointer ahead to an aligned element if the recording fell behind
+  void skip_if_behind(const char*& current_write_pointer, size_t& failed_writes);
+
+  std::vector<int> m_fds; // One per stripe, open from conf to scrap
+  uint64_t m_file_offset = 0; // NOLINT(build/unsigned) Logical offset the next recording continues at
   int m_oflag;
+  UringFileWriter m_writer;
 };
 
 } // namespace datahandlinglibs
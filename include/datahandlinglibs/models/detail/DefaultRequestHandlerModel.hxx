@@ -19,8 +19,23 @@ DefaultRequestHandlerModel<RDT, LBT>::conf(const appmodel::DataHandlerModule* co
   m_num_request_handling_threads = reqh_conf->get_handler_threads();
   m_request_timeout_ms = reqh_conf->get_request_timeout();
 
+  // Request handler threads copy out of the LB, so by default they run on the LB's NUMA node
+  auto lb_conf = conf->get_module_configuration()->get_latency_buffer();
+  CPU_ZERO(&m_request_handler_affinity);
+  if (!m_request_handler_cpus.empty()) {
+    m_request_handler_affinity = cpu_set_from_list(m_request_handler_cpus);
+  } else if (lb_conf->get_numa_aware()) {
+    m_request_handler_affinity = cpu_set_from_numa_node(lb_conf->get_numa_node());
+  }
+
+  bool all_fragment_outputs_networked = true;
   for (auto output : conf->get_outputs()) {
     if (output->get_data_type() == "Fragment") {
+      // Network senders serialize the fragment within send(), so its buffer can be reused right after.
+      // Queues hand the fragment over to the receiver, which rules out pooled buffers.
+      if (output->cast<confmodel::NetworkConnection>() == nullptr) {
+        all_fragment_outputs_networked = false;
+      }
       m_fragment_send_timeout_ms = output->get_send_timeout_ms();
       // 19-Dec-2024, KAB: store the names/IDs of the Fragment output connections so that
       // we can confirm that they are ready for sending at 'start' time.
@@ -35,8 +50,14 @@ DefaultRequestHandlerModel<RDT, LBT>::conf(const appmodel::DataHandlerModule* co
       if (remove(m_output_file.c_str()) == 0) {
         TLOG_DEBUG(TLVL_WORK_STEPS) << "Removed existing output file from previous run: " << m_output_file << std::endl;
       }
+      remove((m_output_file + ".gaps").c_str());
       m_stream_buffer_size = dr->get_streaming_buffer_size();
-      m_buffered_writer.open(m_output_file, m_stream_buffer_size, dr->get_compression_algorithm(), dr->get_use_o_direct());
+      m_compression_algorithm = dr->get_compression_algorithm();
+      m_use_o_direct = dr->get_use_o_direct();
+      m_buffered_writer.set_timestamp_index(
+        sizeof(RDT), static_cast<uint32_t>(RDT::fragment_type), m_recording_index_interval_bytes); // NOLINT(build/unsigned)
+      m_buffered_writer.set_staging_buffers(m_recording_staging_buffers);
+      m_buffered_writer.open(m_output_file, m_stream_buffer_size, m_compression_algorithm, m_use_o_direct);
       m_recording_configured = true;
     }
   }
@@ -52,6 +73,29 @@ DefaultRequestHandlerModel<RDT, LBT>::conf(const appmodel::DataHandlerModule* co
     m_max_requested_elements = m_pop_limit_size - m_pop_limit_size * m_pop_size_pct;
   }
 
+  if (m_fragment_pool_max_bytes > 0 && all_fragment_outputs_networked && !m_frag_out_conn_ids.empty()) {
+    // Size classes go from a single element up to the largest window the buffer can serve,
+    // with one buffer per request handler thread in every class.
+    m_fragment_buffer_pool = std::make_unique<FragmentBufferPool>();
+    m_fragment_buffer_pool->allocate(sizeof(daqdataformats::FragmentHeader) + sizeof(RDT),
+                                     sizeof(daqdataformats::FragmentHeader) + m_max_requested_elements * sizeof(RDT),
+                                     m_num_request_handling_threads,
+                                     m_fragment_pool_max_bytes,
+                                     lb_conf->get_numa_aware(),
+                                     lb_conf->get_numa_node());
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "Fragment buffer pool holds " << m_fragment_buffer_pool->total_bytes()
+                                << " bytes, largest buffer is " << m_fragment_buffer_pool->max_buffer_size() << " bytes";
+  }
+
+  if (m_async_send && m_fragment_send_pipeline == nullptr) {
+    m_fragment_send_pipeline = std::make_shared<FragmentSendPipeline>(
+      m_sourceid,
+      std::chrono::milliseconds(m_fragment_send_timeout_ms),
+      m_async_send_max_queue_depth,
+      [this](const void* storage) { release_fragment_buffer(storage); });
+    this->register_node("fragment_sender", m_fragment_send_pipeline);
+  }
+
   m_recording_thread.set_name("recording", m_sourceid.id);
   m_cleanup_thread.set_name("cleanup", m_sourceid.id);
   m_periodic_transmission_thread.set_name("periodic", m_sourceid.id);
@@ -71,12 +115,23 @@ DefaultRequestHandlerModel<RDT, LBT>::scrap(const nlohmann::json& /*args*/)
   if (m_buffered_writer.is_open()) {
     m_buffered_writer.close();
   }
+  if (m_fragment_send_pipeline != nullptr) {
+    // The next configuration can have other destinations
+    m_fragment_send_pipeline->clear_destinations();
+  }
+  m_fragment_buffer_pool.reset();
 }
 
 template<class RDT, class LBT>
 void 
-DefaultRequestHandlerModel<RDT, LBT>::start(const nlohmann::json& /*args*/)
+DefaultRequestHandlerModel<RDT, LBT>::start(const nlohmann::json& args)
 {
+  m_run_number = args.value<daqdataformats::run_number_t>("run", 1);
+  // The periodic batches have no conf field for their destination, it comes with the start command
+  m_periodic_destination = args.value<std::string>("periodic_destination", m_periodic_destination);
+  m_periodic_cursor_ts = std::numeric_limits<uint64_t>::max();
+  m_periodic_batch_number = 0;
+
   // Reset opmon variables
   m_num_requests_found = 0;
   m_num_requests_bad = 0;
@@ -91,6 +146,18 @@ DefaultRequestHandlerModel<RDT, LBT>::start(const nlohmann::json& /*args*/)
   m_pops_count = 0;
   m_payloads_written = 0;
   m_bytes_written = 0;
+  m_num_fragment_pool_hits = 0;
+  m_num_fragment_pool_misses = 0;
+  m_num_requests_streamed = 0;
+  m_num_stream_chunks_sent = 0;
+  m_num_parallel_assemblies = 0;
+  m_num_request_holds_expired = 0;
+  m_num_response_cache_hits = 0;
+  m_num_response_cache_misses = 0;
+  // Responses of the previous run must not answer requests of this one
+  m_response_cache.configure(
+    m_response_cache_entries, m_response_cache_max_bytes, std::chrono::milliseconds(m_response_cache_ttl_ms));
+  m_response_cache.clear();
 
   m_t0 = std::chrono::high_resolution_clock::now();
 
@@ -109,7 +176,24 @@ DefaultRequestHandlerModel<RDT, LBT>::start(const nlohmann::json& /*args*/)
     }
   }
 
+  if (m_fragment_send_pipeline != nullptr) {
+    for (auto frag_out_conn : m_frag_out_conn_ids) {
+      m_fragment_send_pipeline->add_destination(frag_out_conn);
+    }
+    m_fragment_send_pipeline->start();
+  }
+
   m_request_handler_thread_pool = std::make_unique<boost::asio::thread_pool>(m_num_request_handling_threads);
+  setup_request_handler_threads();
+
+  if (m_stream_response_threshold_bytes > 0 && !m_stream_response_consumer_support) {
+    ers::warning(ConfigurationError(
+      ERS_HERE, m_sourceid, "Response streaming needs a consumer that accepts sub-window fragments, it stays off"));
+  }
+  if (m_periodic_batch_transmission && m_periodic_destination.empty()) {
+    ers::warning(ConfigurationError(
+      ERS_HERE, m_sourceid, "Periodic batch transmission is enabled without a periodic_destination, no batches are sent"));
+  }
 
   m_run_marker.store(true);
   m_cleanup_thread.set_work(&DefaultRequestHandlerModel<RDT, LBT>::periodic_cleanups, this);
@@ -137,15 +221,25 @@ DefaultRequestHandlerModel<RDT, LBT>::stop(const nlohmann::json& /*args*/)
   }
   m_waiting_queue_thread.join();
   m_request_handler_thread_pool->join();
+  {
+    // Requests still waiting at this point are never re-issued
+    std::lock_guard<std::mutex> lock(m_retention_leases_lock);
+    m_retention_leases.clear();
+  }
+  if (m_fragment_send_pipeline != nullptr) {
+    // Sends whatever the request handler threads queued up
+    m_fragment_send_pipeline->stop();
+  }
 }
 
 template<class RDT, class LBT>
 void 
-DefaultRequestHandlerModel<RDT, LBT>::record(const nlohmann::json& /*args*/)
+DefaultRequestHandlerModel<RDT, LBT>::record(const nlohmann::json& args)
 {
-  //auto conf = args.get<readoutconfig::RecordingParams>();
-  //FIXME: how do we pass the duration or recording?
   int recording_time_sec = 1;
+  if (args.contains("duration")) {
+    recording_time_sec = args["duration"];
+  }
   if (m_recording.load()) {
     ers::error(CommandError(ERS_HERE, m_sourceid, "A recording is still running, no new recording was started!"));
     return;
@@ -167,6 +261,12 @@ DefaultRequestHandlerModel<RDT, LBT>::record(const nlohmann::json& /*args*/)
             auto front = m_latency_buffer->front();
             m_next_timestamp_to_record = front == nullptr ? 0 : front->get_timestamp();
           }
+          // Not iterating the LB at this point, so cleanup may go past the skipped data right away
+          auto skip_target = recording_skip_target();
+          if (skip_target > m_next_timestamp_to_record) {
+            mark_recording_gap(m_next_timestamp_to_record, skip_target);
+            m_next_timestamp_to_record = skip_target;
+          }
           element_to_search.set_timestamp(m_next_timestamp_to_record);
           size_t processed_chunks_in_loop = 0;
 
@@ -187,7 +287,8 @@ DefaultRequestHandlerModel<RDT, LBT>::record(const nlohmann::json& /*args*/)
           for (; chunk_iter != end && chunk_iter.good() && processed_chunks_in_loop < 1000;) {
             if ((*chunk_iter).get_timestamp() >= m_next_timestamp_to_record) {
               if (!m_buffered_writer.write(reinterpret_cast<char*>(chunk_iter->begin()), // NOLINT
-                                           chunk_iter->get_payload_size())) {
+                                           chunk_iter->get_payload_size(),
+                                           chunk_iter->get_timestamp())) {
                 ers::warning(CannotWriteToFile(ERS_HERE, m_output_file));
               }
               m_payloads_written++;
@@ -210,12 +311,197 @@ DefaultRequestHandlerModel<RDT, LBT>::record(const nlohmann::json& /*args*/)
     recording_time_sec);
 }
 
+template<class RDT, class LBT>
+uint64_t // NOLINT(build/unsigned)
+DefaultRequestHandlerModel<RDT, LBT>::recording_skip_target()
+{
+  uint64_t max_lag = m_recording_max_lag_ticks; // NOLINT(build/unsigned)
+  if (m_recording_max_lag_bytes > 0) {
+    uint64_t bytes_as_ticks = // NOLINT(build/unsigned)
+      m_recording_max_lag_bytes / sizeof(RDT) * element_ticks();
+    max_lag = max_lag > 0 ? std::min(max_lag, bytes_as_ticks) : bytes_as_ticks;
+  }
+  auto next = m_next_timestamp_to_record.load();
+  auto back = m_latency_buffer->back();
+  if (m_recording_lag_policy != kSkip || max_lag == 0 || next == 0 || back == nullptr ||
+      back->get_timestamp() <= next + max_lag) {
+    return 0;
+  }
+  // Continue half a budget behind the newest data, so the next skip is not due right away
+  return back->get_timestamp() - max_lag / 2;
+}
+
+template<class RDT, class LBT>
+void
+DefaultRequestHandlerModel<RDT, LBT>::mark_recording_gap(uint64_t from, uint64_t to) // NOLINT(build/unsigned)
+{
+  ++m_num_recording_skips;
+  m_recording_ticks_skipped += to - from;
+  TLOG_DEBUG(TLVL_WORK_STEPS) << "Recording fell behind, skipping from " << from << " to " << to;
+  std::ofstream gaps(m_output_file + ".gaps", std::ios::app);
+  gaps << from << " " << to << "\n";
+}
+
+template<class RDT, class LBT>
+bool
+DefaultRequestHandlerModel<RDT, LBT>::parse_dump_args(const nlohmann::json& args,
+                                                      uint64_t& window_begin, // NOLINT(build/unsigned)
+                                                      uint64_t& window_end,   // NOLINT(build/unsigned)
+                                                      std::string& dump_file)
+{
+  if (!m_recording_configured) {
+    ers::error(CommandError(ERS_HERE, m_sourceid, "DLH is not configured for recording, no dump was started!"));
+    return false;
+  }
+  if (m_recording.load()) {
+    ers::error(CommandError(ERS_HERE, m_sourceid, "A recording is still running, no dump was started!"));
+    return false;
+  }
+  if (!args.contains("window_begin") || !args.contains("window_end")) {
+    ers::error(CommandError(ERS_HERE, m_sourceid, "A dump command needs window_begin and window_end!"));
+    return false;
+  }
+  window_begin = args["window_begin"].get<uint64_t>(); // NOLINT(build/unsigned)
+  window_end = args["window_end"].get<uint64_t>();     // NOLINT(build/unsigned)
+  if (window_end <= window_begin) {
+    ers::error(CommandError(ERS_HERE, m_sourceid, "The dump window is empty!"));
+    return false;
+  }
+  dump_file = args.contains("output_file")
+                ? args["output_file"].get<std::string>()
+                : m_output_file + "." + std::to_string(window_begin) + "-" + std::to_string(window_end) + ".dump";
+  return true;
+}
+
+template<class RDT, class LBT>
+void
+DefaultRequestHandlerModel<RDT, LBT>::start_dump_progress()
+{
+  m_dump_bytes = 0;
+  m_dump_progress = 0;
+  m_dump_rate = 0;
+  m_dumping = true;
+}
+
+template<class RDT, class LBT>
+void
+DefaultRequestHandlerModel<RDT, LBT>::update_dump_progress(size_t bytes,
+                                                           double progress,
+                                                           std::chrono::steady_clock::time_point start)
+{
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  m_dump_bytes = bytes;
+  m_dump_progress = progress;
+  m_dump_rate = seconds > 0 ? bytes / seconds / 1e6 : 0;
+}
+
+template<class RDT, class LBT>
+void
+DefaultRequestHandlerModel<RDT, LBT>::dump(const nlohmann::json& args)
+{
+  uint64_t window_begin = 0; // NOLINT(build/unsigned)
+  uint64_t window_end = 0;   // NOLINT(build/unsigned)
+  std::string dump_file;
+  if (!parse_dump_args(args, window_begin, window_end, dump_file)) {
+    return;
+  }
+
+  // The element holding window_begin can start up to one element earlier
+  uint64_t ticks_per_element = element_ticks(); // NOLINT(build/unsigned)
+  uint64_t first_ts = window_begin > ticks_per_element ? window_begin - ticks_per_element : 0; // NOLINT(build/unsigned)
+  // Taken right away, so cleanup cannot remove the window before the dump starts
+  auto lease = acquire_retention_lease(first_ts);
+  m_recording.exchange(true);
+  start_dump_progress();
+
+  bool started = m_recording_thread.set_work([this, window_begin, window_end, first_ts, ticks_per_element, dump_file, lease]() {
+    TLOG() << "Start dumping window [" << window_begin << ", " << window_end << ") to " << dump_file;
+    auto start_of_dump = std::chrono::steady_clock::now();
+    size_t bytes = 0;
+    double progress = 0;
+    BufferedFileWriter<> writer;
+    try {
+      writer.set_timestamp_index(
+        sizeof(RDT), static_cast<uint32_t>(RDT::fragment_type), m_recording_index_interval_bytes); // NOLINT(build/unsigned)
+      writer.open(dump_file, m_stream_buffer_size, m_compression_algorithm, m_use_o_direct);
+    } catch (const ers::Issue& excpt) {
+      ers::error(excpt);
+    }
+
+    if (writer.is_open()) {
+      RDT element_to_search;
+      element_to_search.set_timestamp(first_ts);
+      {
+        std::unique_lock<std::mutex> lock(m_cv_mutex);
+        m_cv.wait(lock, [&] { return !m_cleanup_requested; });
+        m_requests_running++;
+      }
+      m_cv.notify_all();
+      auto element = m_latency_buffer->lower_bound(element_to_search, false);
+      auto end = m_latency_buffer->end();
+      {
+        std::lock_guard<std::mutex> lock(m_cv_mutex);
+        m_requests_running--;
+      }
+      m_cv.notify_all();
+
+      // Only what is in the buffer now is dumped, the lease holds it until it is written
+      size_t elements_in_batch = 0;
+      for (; element != end && element.good(); ++element) {
+        uint64_t timestamp = element->get_timestamp(); // NOLINT(build/unsigned)
+        if (timestamp >= window_end) {
+          break;
+        }
+        if (timestamp + ticks_per_element <= window_begin) {
+          continue;
+        }
+        if (!writer.write(reinterpret_cast<char*>(element->begin()), element->get_payload_size(), timestamp)) { // NOLINT
+          ers::warning(CannotWriteToFile(ERS_HERE, dump_file));
+          break;
+        }
+        bytes += element->get_payload_size();
+        m_payloads_written++;
+        m_bytes_written += element->get_payload_size();
+        progress = std::min(1.0,
+                            static_cast<double>(timestamp + ticks_per_element - window_begin) /
+                              (window_end - window_begin));
+        if (++elements_in_batch == 1000) {
+          elements_in_batch = 0;
+          update_retention_lease(lease, timestamp);
+          update_dump_progress(bytes, progress, start_of_dump);
+        }
+      }
+      writer.close();
+    }
+    release_retention_lease(lease);
+    update_dump_progress(bytes, progress, start_of_dump);
+
+    TLOG() << "Dumped " << bytes << " bytes of window [" << window_begin << ", " << window_end << ") at "
+           << m_dump_rate.load() << " MB/s" << (progress < 1 ? ", the buffer did not hold all of the window" : "");
+    m_dumping = false;
+    m_recording.exchange(false);
+  });
+  if (!started) {
+    ers::error(CommandError(ERS_HERE, m_sourceid, "The recording thread is busy, no dump was started!"));
+    release_retention_lease(lease);
+    m_dumping = false;
+    m_recording.exchange(false);
+  }
+}
+
 template<class RDT, class LBT>
 void 
 DefaultRequestHandlerModel<RDT, LBT>::cleanup_check()
 {
   std::unique_lock<std::mutex> lock(m_cv_mutex);
-  if (m_latency_buffer->occupancy() > m_pop_limit_size && !m_cleanup_requested.exchange(true)) {
+  bool retention_exceeded = false;
+  if (m_retention_ticks > 0) {
+    auto front = m_latency_buffer->front();
+    auto back = m_latency_buffer->back();
+    retention_exceeded = front != nullptr && back != nullptr &&
+                         back->get_timestamp() - front->get_timestamp() > m_retention_ticks;
+  }
+  if ((retention_exceeded || m_latency_buffer->occupancy() > m_pop_limit_size) && !m_cleanup_requested.exchange(true)) {
     m_cv.wait(lock, [&] { return m_requests_running == 0; });
     cleanup();
     m_cleanup_requested = false;
@@ -227,55 +513,247 @@ template<class RDT, class LBT>
 void 
 DefaultRequestHandlerModel<RDT, LBT>::issue_request(dfmessages::DataRequest datarequest, bool is_retry)
 {
-  boost::asio::post(*m_request_handler_thread_pool, [&, datarequest, is_retry]() { // start a thread from pool
+  post_request(datarequest, is_retry, s_no_retention_lease);
+}
+
+template<class RDT, class LBT>
+void
+DefaultRequestHandlerModel<RDT, LBT>::post_request(dfmessages::DataRequest datarequest,
+                                                   bool is_retry,
+                                                   uint64_t lease_id) // NOLINT(build/unsigned)
+{
+  auto t_posted = std::chrono::high_resolution_clock::now();
+  boost::asio::post(*m_request_handler_thread_pool, [&, datarequest, is_retry, lease_id, t_posted]() { // start a thread from pool
     auto t_req_begin = std::chrono::high_resolution_clock::now();
+    m_request_stage_latency[kQueueWait].record_since(t_posted, t_req_begin);
+    if (send_cached_response(datarequest)) {
+      // Duplicate of a request that was already answered, the latency buffer is not touched
+    } else if (m_stream_response_consumer_support && m_stream_response_threshold_bytes > 0 &&
+               estimate_response_size(datarequest) > m_stream_response_threshold_bytes) {
+      stream_response(datarequest, is_retry);
+    } else {
+      {
+        std::unique_lock<std::mutex> lock(m_cv_mutex);
+        m_cv.wait(lock, [&] { return !m_cleanup_requested; });
+        m_requests_running++;
+      }
+      m_cv.notify_all();
+      m_request_stage_latency[kCleanupWait].record_since(t_req_begin, std::chrono::high_resolution_clock::now());
+      auto result = data_request(datarequest);
+      {
+        std::lock_guard<std::mutex> lock(m_cv_mutex);
+        m_requests_running--;
+      }
+      m_cv.notify_all();
+      if ((result.result_code == ResultCode::kNotYet || result.result_code == ResultCode::kPartial) && m_request_timeout_ms >0 && is_retry == false) {
+        const void* fragment_storage = result.fragment ? result.fragment->get_storage_location() : nullptr;
+        result.fragment.reset();
+        release_fragment_buffer(fragment_storage);
+        add_waiting_request(datarequest);
+      }
+      else {
+        TLOG_DEBUG(TLVL_WORK_STEPS) << "Responding with result code " << result.result_code;
+        cache_response(datarequest, result);
+        send_fragment(std::move(result.fragment), datarequest.data_destination);
+      }
+    }
+    if (lease_id != s_no_retention_lease) {
+      release_retention_lease(lease_id);
+    }
+
+    auto t_req_end = std::chrono::high_resolution_clock::now();
+    auto us_req_took = std::chrono::duration_cast<std::chrono::microseconds>(t_req_end - t_req_begin);
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "Responding to data request took: " << us_req_took.count() << "[us]";
+    m_response_time_acc.fetch_add(us_req_took.count());
+    update_max(m_response_time_max, us_req_took.count());
+    update_min(m_response_time_min, us_req_took.count());
+    m_handled_requests++;
+  });
+}
+
+template<class RDT, class LBT>
+void
+DefaultRequestHandlerModel<RDT, LBT>::add_waiting_request(const dfmessages::DataRequest& dr)
+{
+  TLOG_DEBUG(TLVL_WORK_STEPS) << "Re-queue request. "
+                              << " with timestamp=" << dr.trigger_timestamp;
+  // Hold back cleanup of the element holding window_begin until the request is re-issued
+  uint64_t lease_id = s_no_retention_lease; // NOLINT(build/unsigned)
+  if (m_max_request_hold_ms > 0) {
+    uint64_t ticks_per_element = element_ticks(); // NOLINT(build/unsigned)
+    uint64_t window_begin = dr.request_information.window_begin;                           // NOLINT(build/unsigned)
+    lease_id = acquire_retention_lease(window_begin > ticks_per_element ? window_begin - ticks_per_element : 0,
+                                       std::chrono::milliseconds(m_max_request_hold_ms));
+  }
+  std::lock_guard<std::mutex> wait_lock_guard(m_waiting_requests_lock);
+  m_waiting_requests.push_back(RequestElement(dr, std::chrono::high_resolution_clock::now(), lease_id));
+}
+
+template<class RDT, class LBT>
+bool
+DefaultRequestHandlerModel<RDT, LBT>::send_fragment(std::unique_ptr<daqdataformats::Fragment> fragment,
+                                                    const std::string& destination)
+{
+  if (m_fragment_send_pipeline != nullptr && m_fragment_send_pipeline->is_running()) {
+    // The pipeline returns the buffer to the pool once the fragment is sent
+    auto t_send_begin = std::chrono::high_resolution_clock::now();
+    bool sent = m_fragment_send_pipeline->send(std::move(fragment), destination);
+    m_request_stage_latency[kSend].record_since(t_send_begin, std::chrono::high_resolution_clock::now());
+    return sent;
+  }
+  bool sent = true;
+  const void* fragment_storage = fragment->get_storage_location();
+  try { // Send to fragment connection
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "Sending fragment with trigger/sequence_number "
+      << fragment->get_trigger_number() << "."
+      << fragment->get_sequence_number() << ", run number "
+      << fragment->get_run_number() << ", and DetectorID "
+      << fragment->get_detector_id() << ", and SourceID "
+      << fragment->get_element_id() << ", and size "
+      << fragment->get_size();
+    // Send fragment
+    auto t_send_begin = std::chrono::high_resolution_clock::now();
+    get_iom_sender<std::unique_ptr<daqdataformats::Fragment>>(destination)
+      ->send(std::move(fragment), std::chrono::milliseconds(m_fragment_send_timeout_ms));
+    m_request_stage_latency[kSend].record_since(t_send_begin, std::chrono::high_resolution_clock::now());
+
+  } catch (const ers::Issue& excpt) {
+    ers::warning(CannotWriteToQueue(ERS_HERE, m_sourceid, destination, excpt));
+    sent = false;
+  }
+  fragment.reset();
+  release_fragment_buffer(fragment_storage);
+  return sent;
+}
+
+template<class RDT, class LBT>
+size_t
+DefaultRequestHandlerModel<RDT, LBT>::estimate_response_size(const dfmessages::DataRequest& dr)
+{
+  const auto& window = dr.request_information;
+  if (window.window_end <= window.window_begin) {
+    return 0;
+  }
+  uint64_t ticks_per_element = element_ticks(); // NOLINT(build/unsigned)
+  if (ticks_per_element == 0) {
+    return 0;
+  }
+  return ((window.window_end - window.window_begin) / ticks_per_element + 1) * sizeof(RDT);
+}
+
+template<class RDT, class LBT>
+void
+DefaultRequestHandlerModel<RDT, LBT>::stream_response(const dfmessages::DataRequest& dr, bool is_retry)
+{
+  const uint64_t window_begin = dr.request_information.window_begin; // NOLINT(build/unsigned)
+  const uint64_t window_end = dr.request_information.window_end;     // NOLINT(build/unsigned)
+
+  // The lease keeps the part of the window that is not sent yet in the buffer. The element holding a
+  // timestamp can start up to one element earlier. A stuck send cannot hold back cleanup for longer than max_hold.
+  const uint64_t ticks_per_element = element_ticks(); // NOLINT(build/unsigned)
+  auto lease_start = [&](uint64_t ts) { // NOLINT(build/unsigned)
+    return ts > ticks_per_element ? ts - ticks_per_element : 0;
+  };
+  auto lease = acquire_retention_lease(lease_start(window_begin),
+                                       std::chrono::milliseconds(m_stream_response_max_hold_ms));
+
+  // Wait for the whole window to arrive first, like for any other request
+  auto last_element = m_latency_buffer->back();
+  if (m_request_timeout_ms > 0 && !is_retry && (last_element == nullptr || last_element->get_timestamp() < window_end)) {
+    ++m_num_requests_delayed;
+    add_waiting_request(dr);
+    release_retention_lease(lease);
+    return;
+  }
+
+  ++m_num_requests_streamed;
+  uint64_t elements_per_chunk = std::max<size_t>(1, m_stream_response_threshold_bytes / sizeof(RDT)); // NOLINT(build/unsigned)
+  uint64_t chunk_ticks = std::max<uint64_t>(elements_per_chunk * ticks_per_element, 1); // NOLINT(build/unsigned)
+
+  for (uint64_t chunk_begin = window_begin; chunk_begin < window_end; chunk_begin += chunk_ticks) { // NOLINT(build/unsigned)
+    dfmessages::DataRequest chunk_request = dr;
+    chunk_request.request_information.window_begin = chunk_begin;
+    chunk_request.request_information.window_end = std::min(chunk_begin + chunk_ticks, window_end);
+
+    auto t_chunk_begin = std::chrono::high_resolution_clock::now();
     {
       std::unique_lock<std::mutex> lock(m_cv_mutex);
       m_cv.wait(lock, [&] { return !m_cleanup_requested; });
       m_requests_running++;
     }
     m_cv.notify_all();
-    auto result = data_request(datarequest);
+    m_request_stage_latency[kCleanupWait].record_since(t_chunk_begin, std::chrono::high_resolution_clock::now());
+    auto result = data_request(chunk_request);
     {
       std::lock_guard<std::mutex> lock(m_cv_mutex);
       m_requests_running--;
     }
     m_cv.notify_all();
-    if ((result.result_code == ResultCode::kNotYet || result.result_code == ResultCode::kPartial) && m_request_timeout_ms >0 && is_retry == false) {
-      TLOG_DEBUG(TLVL_WORK_STEPS) << "Re-queue request. "
-                                  << " with timestamp=" << result.data_request.trigger_timestamp;
-      std::lock_guard<std::mutex> wait_lock_guard(m_waiting_requests_lock);
-      m_waiting_requests.push_back(RequestElement(datarequest, std::chrono::high_resolution_clock::now()));
+
+    update_retention_lease(lease, lease_start(chunk_request.request_information.window_end));
+    if (!send_fragment(std::move(result.fragment), dr.data_destination)) {
+      break;
     }
-    else {
-      try { // Send to fragment connection
-        TLOG_DEBUG(TLVL_WORK_STEPS) << "Sending fragment with trigger/sequence_number "
-          << result.fragment->get_trigger_number() << "."
-          << result.fragment->get_sequence_number() << ", run number "
-          << result.fragment->get_run_number() << ", and DetectorID "
-          << result.fragment->get_detector_id() << ", and SourceID "
-          << result.fragment->get_element_id() << ", and size "
-          << result.fragment->get_size() << ", and result code "
-	  << result.result_code;
-        // Send fragment
-        get_iom_sender<std::unique_ptr<daqdataformats::Fragment>>(datarequest.data_destination)
-          ->send(std::move(result.fragment), std::chrono::milliseconds(m_fragment_send_timeout_ms));
-
-      } catch (const ers::Issue& excpt) {
-        ers::warning(CannotWriteToQueue(ERS_HERE, m_sourceid, datarequest.data_destination, excpt));
-      }
+    ++m_num_stream_chunks_sent;
+
+    // The rest of the window is not in the buffer, or this chunk had no data: the last fragment carries the error bits
+    if (result.result_code == ResultCode::kNotYet || result.result_code == ResultCode::kPartial ||
+        result.result_code == ResultCode::kNotFound || result.result_code == ResultCode::kTooOld) {
+      break;
     }
+  }
+  release_retention_lease(lease);
+}
 
-    auto t_req_end = std::chrono::high_resolution_clock::now();
-    auto us_req_took = std::chrono::duration_cast<std::chrono::microseconds>(t_req_end - t_req_begin);
-    TLOG_DEBUG(TLVL_WORK_STEPS) << "Responding to data request took: " << us_req_took.count() << "[us]";
-    m_response_time_acc.fetch_add(us_req_took.count());
-    if ( us_req_took.count() > m_response_time_max.load() )
-      m_response_time_max.store(us_req_took.count());
-    if ( us_req_took.count() < m_response_time_min.load() )
-      m_response_time_min.store(us_req_took.count());
-    m_handled_requests++;
-  });
+template<class RDT, class LBT>
+uint64_t // NOLINT(build/unsigned)
+DefaultRequestHandlerModel<RDT, LBT>::acquire_retention_lease(uint64_t timestamp, // NOLINT(build/unsigned)
+                                                              std::chrono::milliseconds max_hold)
+{
+  std::lock_guard<std::mutex> lock(m_retention_leases_lock);
+  auto lease_id = m_next_retention_lease_id++;
+  m_retention_leases[lease_id] = RetentionLease{ timestamp, std::chrono::steady_clock::now(), max_hold };
+  return lease_id;
+}
+
+template<class RDT, class LBT>
+void
+DefaultRequestHandlerModel<RDT, LBT>::update_retention_lease(uint64_t lease_id, uint64_t timestamp) // NOLINT(build/unsigned)
+{
+  std::lock_guard<std::mutex> lock(m_retention_leases_lock);
+  auto lease = m_retention_leases.find(lease_id);
+  if (lease != m_retention_leases.end()) {
+    lease->second.timestamp = timestamp;
+  }
+}
+
+template<class RDT, class LBT>
+void
+DefaultRequestHandlerModel<RDT, LBT>::release_retention_lease(uint64_t lease_id) // NOLINT(build/unsigned)
+{
+  std::lock_guard<std::mutex> lock(m_retention_leases_lock);
+  m_retention_leases.erase(lease_id);
+}
+
+template<class RDT, class LBT>
+uint64_t // NOLINT(build/unsigned)
+DefaultRequestHandlerModel<RDT, LBT>::get_cleanup_floor()
+{
+  uint64_t floor = m_next_timestamp_to_record; // NOLINT(build/unsigned)
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(m_retention_leases_lock);
+  for (auto& [lease_id, lease] : m_retention_leases) {
+    // Bounded leases stop protecting their data once expired, so a stuck request cannot stall the buffer
+    if (lease.max_hold.count() > 0 && now - lease.acquired > lease.max_hold) {
+      if (lease.timestamp != s_no_retention_lease) {
+        ++m_num_request_holds_expired;
+        lease.timestamp = s_no_retention_lease;
+      }
+      continue;
+    }
+    floor = std::min(floor, lease.timestamp);
+  }
+  return floor;
 }
 
 template<class RDT, class LBT>
@@ -320,13 +798,45 @@ DefaultRequestHandlerModel<RDT, LBT>::generate_opmon_data()
    info.set_num_buffer_cleanups(m_num_buffer_cleanups.exchange(0));
    info.set_num_periodic_sent(m_num_periodic_sent.exchange(0));
    info.set_num_periodic_send_failed(m_num_periodic_send_failed.exchange(0));
+   info.set_num_fragment_pool_hits(m_num_fragment_pool_hits.exchange(0));
+   info.set_num_fragment_pool_misses(m_num_fragment_pool_misses.exchange(0));
+   info.set_num_requests_streamed(m_num_requests_streamed.exchange(0));
+   info.set_num_stream_chunks_sent(m_num_stream_chunks_sent.exchange(0));
+   info.set_num_parallel_assemblies(m_num_parallel_assemblies.exchange(0));
+   info.set_num_request_holds_expired(m_num_request_holds_expired.exchange(0));
+   info.set_num_response_cache_hits(m_num_response_cache_hits.exchange(0));
+   info.set_num_response_cache_misses(m_num_response_cache_misses.exchange(0));
 
    this->publish(std::move(info));
 
+   for (size_t stage = 0; stage < kNumRequestStages; ++stage) {
+     auto snap = m_request_stage_latency[stage].snapshot_and_reset();
+     opmon::RequestStageLatencyInfo sinfo;
+     sinfo.set_count(snap.count);
+     sinfo.set_p50(snap.p50);
+     sinfo.set_p90(snap.p90);
+     sinfo.set_p99(snap.p99);
+     sinfo.set_p999(snap.p999);
+     sinfo.set_max(snap.max);
+     this->publish(std::move(sinfo), {{"stage", s_request_stage_names[stage]}});
+   }
+
    opmon::RecordingInfo rinfo;
-   rinfo.set_recording_status(m_recording? "Y" : "N");
+   rinfo.set_recording_status(m_dumping ? "D" : (m_recording ? "Y" : "N"));
    rinfo.set_packets_recorded(m_payloads_written.exchange(0));   
    rinfo.set_bytes_recorded(m_bytes_written.exchange(0));   
+   rinfo.set_dump_bytes(m_dump_bytes.load());
+   rinfo.set_dump_progress(m_dump_progress.load());
+   rinfo.set_dump_rate(m_dump_rate.load());
+   rinfo.set_lag_policy(m_recording_lag_policy == kSkip ? "skip" : "block");
+   auto newest = m_latency_buffer->back();
+   auto next_to_record = m_next_timestamp_to_record.load();
+   if (m_recording && !m_dumping && newest != nullptr && next_to_record != 0 &&
+       newest->get_timestamp() > next_to_record) {
+     rinfo.set_lag_ticks(newest->get_timestamp() - next_to_record);
+   }
+   rinfo.set_num_skips(m_num_recording_skips.exchange(0));
+   rinfo.set_ticks_skipped(m_recording_ticks_skipped.exchange(0));
    this->publish(std::move(rinfo));
  }
 
@@ -342,6 +852,193 @@ DefaultRequestHandlerModel<RDT, LBT>::create_empty_fragment(const dfmessages::Da
   return fragment;
 }
 
+template<class RDT, class LBT>
+std::unique_ptr<daqdataformats::Fragment>
+DefaultRequestHandlerModel<RDT, LBT>::build_fragment(const std::vector<std::pair<void*, size_t>>& frag_pieces,
+                                                     daqdataformats::FragmentHeader& frag_header)
+{
+  size_t fragment_size = sizeof(frag_header);
+  for (const auto& piece : frag_pieces) {
+    fragment_size += piece.second;
+  }
+  bool streaming_copy = m_nt_copy_threshold_bytes > 0 && fragment_size >= m_nt_copy_threshold_bytes;
+  bool parallel_copy = m_parallel_copy_threshold_bytes > 0 && fragment_size >= m_parallel_copy_threshold_bytes &&
+                       m_num_request_handling_threads > 1 && m_request_handler_thread_pool != nullptr;
+
+  void* buffer = nullptr;
+  if (m_fragment_buffer_pool != nullptr) {
+    buffer = m_fragment_buffer_pool->acquire(fragment_size);
+    if (buffer != nullptr) {
+      ++m_num_fragment_pool_hits;
+    } else {
+      ++m_num_fragment_pool_misses;
+    }
+  }
+  bool pooled = buffer != nullptr;
+
+  if (!pooled && !streaming_copy && !parallel_copy) {
+    auto fragment = std::make_unique<daqdataformats::Fragment>(frag_pieces);
+    fragment->set_header_fields(frag_header);
+    return fragment;
+  }
+
+  if (!pooled) {
+    // The fragment takes ownership and frees it with free()
+    buffer = std::malloc(fragment_size);
+    if (buffer == nullptr) {
+      throw std::bad_alloc();
+    }
+  }
+  frag_header.size = fragment_size;
+  std::memcpy(buffer, &frag_header, sizeof(frag_header));
+  char* payload = static_cast<char*>(buffer) + sizeof(frag_header);
+  if (parallel_copy) {
+    parallel_copy_pieces(payload, frag_pieces, fragment_size - sizeof(frag_header), streaming_copy);
+    ++m_num_parallel_assemblies;
+  } else {
+    copy_pieces(payload, frag_pieces, streaming_copy);
+  }
+  // A pooled buffer is only viewed by the fragment, it goes back to the pool in release_fragment_buffer()
+  return std::make_unique<daqdataformats::Fragment>(
+    buffer,
+    pooled ? daqdataformats::Fragment::BufferAdoptionMode::kReadOnlyMode
+           : daqdataformats::Fragment::BufferAdoptionMode::kTakeOverBuffer);
+}
+
+template<class RDT, class LBT>
+void
+DefaultRequestHandlerModel<RDT, LBT>::copy_pieces(char* dest,
+                                                  const std::vector<std::pair<void*, size_t>>& frag_pieces,
+                                                  bool streaming_copy)
+{
+  for (const auto& piece : frag_pieces) {
+    if (streaming_copy) {
+      buffer_copy_nt(dest, piece.first, piece.second);
+    } else {
+      std::memcpy(dest, piece.first, piece.second);
+    }
+    dest += piece.second;
+  }
+}
+
+template<class RDT, class LBT>
+void
+DefaultRequestHandlerModel<RDT, LBT>::parallel_copy_pieces(char* dest,
+                                                           const std::vector<std::pair<void*, size_t>>& frag_pieces,
+                                                           size_t payload_size,
+                                                           bool streaming_copy)
+{
+  // The payload is cut into byte ranges that are claimed one by one by the calling thread and by
+  // helpers posted to the pool. The caller never waits for a helper to start, so a busy pool only
+  // means less parallelism. Helpers that start after every range was claimed return immediately;
+  // all they touch is the shared state, which they co-own.
+  struct CopyState
+  {
+    std::vector<std::pair<void*, size_t>> pieces;
+    std::vector<size_t> piece_offsets;
+    char* dest;
+    size_t payload_size;
+    size_t chunk_size;
+    size_t num_chunks;
+    bool streaming_copy;
+    std::atomic<size_t> next_chunk{ 0 };
+    std::atomic<size_t> chunks_done{ 0 };
+    std::mutex mutex;
+    std::condition_variable cv;
+  };
+
+  size_t num_chunks = std::min(m_num_request_handling_threads, payload_size / std::max<size_t>(m_parallel_copy_chunk_bytes, 1));
+  if (num_chunks < 2) {
+    copy_pieces(dest, frag_pieces, streaming_copy);
+    return;
+  }
+
+  auto state = std::make_shared<CopyState>();
+  state->pieces = frag_pieces;
+  state->piece_offsets.reserve(frag_pieces.size());
+  size_t offset = 0;
+  for (const auto& piece : frag_pieces) {
+    state->piece_offsets.push_back(offset);
+    offset += piece.second;
+  }
+  state->dest = dest;
+  state->payload_size = payload_size;
+  state->num_chunks = num_chunks;
+  state->chunk_size = (payload_size + num_chunks - 1) / num_chunks;
+  state->streaming_copy = streaming_copy;
+
+  auto copy_chunks = [](CopyState& st) {
+    for (size_t chunk = st.next_chunk++; chunk < st.num_chunks; chunk = st.next_chunk++) {
+      size_t begin = chunk * st.chunk_size;
+      size_t end = std::min(begin + st.chunk_size, st.payload_size);
+      // First piece overlapping the range
+      auto it = std::upper_bound(st.piece_offsets.begin(), st.piece_offsets.end(), begin);
+      for (size_t i = std::distance(st.piece_offsets.begin(), it) - 1; i < st.pieces.size() && st.piece_offsets[i] < end; ++i) {
+        size_t from = std::max(begin, st.piece_offsets[i]);
+        size_t to = std::min(end, st.piece_offsets[i] + st.pieces[i].second);
+        const char* src = static_cast<const char*>(st.pieces[i].first) + (from - st.piece_offsets[i]);
+        if (st.streaming_copy) {
+          buffer_copy_nt(st.dest + from, src, to - from);
+        } else {
+          std::memcpy(st.dest + from, src, to - from);
+        }
+      }
+      if (++st.chunks_done == st.num_chunks) {
+        std::lock_guard<std::mutex> lock(st.mutex);
+        st.cv.notify_all();
+      }
+    }
+  };
+
+  for (size_t i = 1; i < num_chunks; ++i) {
+    boost::asio::post(*m_request_handler_thread_pool, [state, copy_chunks]() { copy_chunks(*state); });
+  }
+  copy_chunks(*state);
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->cv.wait(lock, [&] { return state->chunks_done.load() == state->num_chunks; });
+}
+
+template<class RDT, class LBT>
+void
+DefaultRequestHandlerModel<RDT, LBT>::release_fragment_buffer(const void* storage)
+{
+  if (m_fragment_buffer_pool != nullptr && storage != nullptr) {
+    m_fragment_buffer_pool->release(storage);
+  }
+}
+
+template<class RDT, class LBT>
+void
+DefaultRequestHandlerModel<RDT, LBT>::setup_request_handler_threads()
+{
+  // One task per pool thread. Every task holds its thread until all of them arrived,
+  // so each thread of the pool runs exactly one of them.
+  struct Barrier
+  {
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t arrived = 0;
+  };
+  auto barrier = std::make_shared<Barrier>();
+  const size_t num_threads = m_num_request_handling_threads;
+  for (size_t i = 0; i < num_threads; ++i) {
+    boost::asio::post(*m_request_handler_thread_pool, [this, barrier, num_threads, i]() {
+      auto name = "reqh-" + std::to_string(m_sourceid.id) + "-" + std::to_string(i);
+      if (!name_and_pin_current_thread(name, m_request_handler_affinity)) {
+        ers::warning(GenericConfigurationError(ERS_HERE, "Could not set the CPU affinity of thread " + name));
+      }
+      std::unique_lock<std::mutex> lock(barrier->mutex);
+      ++barrier->arrived;
+      barrier->cv.notify_all();
+      barrier->cv.wait(lock, [&] { return barrier->arrived == num_threads; });
+    });
+  }
+  std::unique_lock<std::mutex> lock(barrier->mutex);
+  barrier->cv.wait(lock, [&] { return barrier->arrived == num_threads; });
+  TLOG_DEBUG(TLVL_WORK_STEPS) << "Request handler threads set up, pinned to " << CPU_COUNT(&m_request_handler_affinity)
+                              << " CPUs";
+}
+
 template<class RDT, class LBT>
 void 
 DefaultRequestHandlerModel<RDT, LBT>::periodic_cleanups()
@@ -365,20 +1062,137 @@ DefaultRequestHandlerModel<RDT, LBT>::periodic_data_transmissions()
 template<class RDT, class LBT>
 void 
 DefaultRequestHandlerModel<RDT, LBT>::periodic_data_transmission()
-{}
+{
+  if (!m_periodic_batch_transmission) {
+    return;
+  }
+  // The batches are not answers to trigger requests, so they never go to the fragment outputs by default
+  if (m_periodic_destination.empty()) {
+    return;
+  }
+  auto fragment = extract_periodic_batch();
+  if (fragment == nullptr) {
+    return;
+  }
+  if (send_fragment(std::move(fragment), m_periodic_destination)) {
+    ++m_num_periodic_sent;
+  } else {
+    ++m_num_periodic_send_failed;
+  }
+}
+
+template<class RDT, class LBT>
+bool
+DefaultRequestHandlerModel<RDT, LBT>::send_cached_response(const dfmessages::DataRequest& dr)
+{
+  if (!m_response_cache.is_enabled()) {
+    return false;
+  }
+  auto response = m_response_cache.find({ dr.trigger_number,
+                                          dr.sequence_number,
+                                          dr.request_information.window_begin,
+                                          dr.request_information.window_end });
+  if (response == nullptr) {
+    ++m_num_response_cache_misses;
+    return false;
+  }
+  ++m_num_response_cache_hits;
+  // The cached response is a whole serialized fragment, header included. The new fragment gets its own copy of it,
+  // the cached response stays available for further duplicates.
+  auto fragment = std::make_unique<daqdataformats::Fragment>(const_cast<char*>(response->data()), // NOLINT
+                                                             daqdataformats::Fragment::BufferAdoptionMode::kCopyFromBuffer);
+  send_fragment(std::move(fragment), dr.data_destination);
+  return true;
+}
+
+template<class RDT, class LBT>
+void
+DefaultRequestHandlerModel<RDT, LBT>::cache_response(const dfmessages::DataRequest& dr, const RequestResult& result)
+{
+  // Only final answers are cached: the data of a kNotYet or kPartial response may still arrive.
+  // Caching copies the whole fragment on the request handling thread, so it is only done with the cache enabled.
+  if (!m_response_cache.is_enabled() || result.fragment == nullptr ||
+      (result.result_code != ResultCode::kFound && result.result_code != ResultCode::kPartiallyOld &&
+       result.result_code != ResultCode::kTooOld)) {
+    return;
+  }
+  m_response_cache.insert(
+    { dr.trigger_number, dr.sequence_number, dr.request_information.window_begin, dr.request_information.window_end },
+    result.fragment->get_storage_location(),
+    result.fragment->get_size());
+}
+
+template<class RDT, class LBT>
+std::unique_ptr<daqdataformats::Fragment>
+DefaultRequestHandlerModel<RDT, LBT>::extract_periodic_batch()
+{
+  auto front_element = m_latency_buffer->front(); // NOLINT
+  auto last_element = m_latency_buffer->back();   // NOLINT
+  if (front_element == nullptr || last_element == nullptr) {
+    return nullptr;
+  }
+  if (m_periodic_cursor_ts == std::numeric_limits<uint64_t>::max()) {
+    m_periodic_cursor_ts = front_element->get_timestamp();
+  }
+  // The newest element closes the window, it opens the next batch
+  uint64_t window_end = last_element->get_timestamp(); // NOLINT(build/unsigned)
+  if (window_end <= m_periodic_cursor_ts) {
+    return nullptr;
+  }
+
+  dfmessages::DataRequest dr;
+  dr.trigger_number = ++m_periodic_batch_number;
+  dr.sequence_number = 0;
+  dr.run_number = m_run_number;
+  dr.trigger_timestamp = m_periodic_cursor_ts;
+  dr.request_information.window_begin = m_periodic_cursor_ts;
+  dr.request_information.window_end = window_end;
+  RequestResult rres(ResultCode::kUnknown, dr);
+  auto frag_header = create_fragment_header(dr);
+
+  // One window operation for the whole batch, synchronized with cleanup like any request
+  {
+    std::unique_lock<std::mutex> lock(m_cv_mutex);
+    m_cv.wait(lock, [&] { return !m_cleanup_requested; });
+    m_requests_running++;
+  }
+  m_cv.notify_all();
+  auto frag_pieces = get_fragment_pieces(dr.request_information.window_begin, window_end, rres);
+  std::unique_ptr<daqdataformats::Fragment> fragment;
+  if (!frag_pieces.empty()) {
+    if (rres.result_code == ResultCode::kPartiallyOld) {
+      // Part of the data since the last batch was cleaned up before it could be sent
+      frag_header.error_bits |= (0x1 << static_cast<size_t>(daqdataformats::FragmentErrorBits::kIncomplete));
+    }
+    fragment = build_fragment(frag_pieces, frag_header);
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_cv_mutex);
+    m_requests_running--;
+  }
+  m_cv.notify_all();
+
+  m_periodic_cursor_ts = window_end;
+  return fragment;
+}
 
 template<class RDT, class LBT>
 void 
 DefaultRequestHandlerModel<RDT, LBT>::cleanup()
 {
+  if (m_retention_ticks > 0) {
+    retention_cleanup();
+  }
+  // The occupancy based cleanup stays active as a safety net
   auto size_guess = m_latency_buffer->occupancy();
   if (size_guess > m_pop_limit_size) {
     ++m_pop_reqs;
     unsigned to_pop = m_pop_size_pct * m_latency_buffer->occupancy();
 
     unsigned popped = 0;
+    auto cleanup_floor = get_cleanup_floor();
     for (size_t i = 0; i < to_pop; ++i) {
-      if (m_latency_buffer->front()->get_timestamp() < m_next_timestamp_to_record) {
+      if (m_latency_buffer->front()->get_timestamp() < cleanup_floor) {
         m_latency_buffer->pop(1);
         popped++;
       } else {
@@ -392,6 +1206,45 @@ DefaultRequestHandlerModel<RDT, LBT>::cleanup()
   m_num_buffer_cleanups++;
 }
 
+template<class RDT, class LBT>
+void
+DefaultRequestHandlerModel<RDT, LBT>::retention_cleanup()
+{
+  auto front = m_latency_buffer->front();
+  auto back = m_latency_buffer->back();
+  if (front == nullptr || back == nullptr || back->get_timestamp() <= m_retention_ticks) {
+    return;
+  }
+  uint64_t horizon = std::min<uint64_t>(back->get_timestamp() - m_retention_ticks, get_cleanup_floor()); // NOLINT(build/unsigned)
+  if (front->get_timestamp() >= horizon) {
+    return;
+  }
+  ++m_pop_reqs;
+
+  size_t popped = 0;
+  if constexpr (has_elements_before<LBT>::value) {
+    // Find the cut with the buffer's search model and drop everything before it at once
+    RDT horizon_element;
+    horizon_element.set_timestamp(horizon);
+    auto cut_iter = m_latency_buffer->lower_bound(horizon_element, m_error_registry->has_error("MISSING_FRAMES"));
+    if (cut_iter.good()) {
+      popped = m_latency_buffer->elements_before(cut_iter);
+      m_latency_buffer->pop(popped);
+    }
+  } else {
+    while (m_latency_buffer->front() != nullptr && m_latency_buffer->front()->get_timestamp() < horizon) {
+      m_latency_buffer->pop(1);
+      popped++;
+    }
+  }
+
+  m_occupancy = m_latency_buffer->occupancy();
+  m_pops_count += popped;
+  if (m_latency_buffer->front() != nullptr) {
+    m_error_registry->remove_errors_until(m_latency_buffer->front()->get_timestamp());
+  }
+}
+
 template<class RDT, class LBT>
 void 
 DefaultRequestHandlerModel<RDT, LBT>::check_waiting_requests()
@@ -411,11 +1264,11 @@ DefaultRequestHandlerModel<RDT, LBT>::check_waiting_requests()
 
       for (auto iter = m_waiting_requests.begin(); iter!= m_waiting_requests.end();) {
 	if((*iter).request.request_information.window_end < newest_ts) {
-          issue_request((*iter).request, true);
+          post_request((*iter).request, true, (*iter).lease_id);
 	  iter = m_waiting_requests.erase(iter);
 	}
 	else if (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - (*iter).start_time).count() >= m_request_timeout_ms) {
-          issue_request((*iter).request, true);
+          post_request((*iter).request, true, (*iter).lease_id);
           if (m_warn_on_timeout) {
             ers::warning(dunedaq::datahandlinglibs::VerboseRequestTimedOut(ERS_HERE, m_sourceid,
                                                                       (*iter).request.trigger_number,
@@ -466,9 +1319,12 @@ DefaultRequestHandlerModel<RDT, LBT>::get_fragment_pieces(uint64_t start_win_ts,
     request_element.set_timestamp(start_win_ts-(request_element.get_num_frames() * RDT::expected_tick_difference));
     //request_element.set_timestamp(start_win_ts);
 
+    auto t_lower_bound = std::chrono::high_resolution_clock::now();
     auto start_iter = m_error_registry->has_error("MISSING_FRAMES")
                       ? m_latency_buffer->lower_bound(request_element, true)
                       : m_latency_buffer->lower_bound(request_element, false);
+    auto t_extraction = std::chrono::high_resolution_clock::now();
+    m_request_stage_latency[kLowerBound].record_since(t_lower_bound, t_extraction);
     if (!start_iter.good()) {
       // Accessor problem 
       rres.result_code = ResultCode::kNotFound;
@@ -488,9 +1344,25 @@ DefaultRequestHandlerModel<RDT, LBT>::get_fragment_pieces(uint64_t start_win_ts,
 
       auto elements_handled = 0;
 
+      // A second iterator runs m_prefetch_distance elements ahead and prefetches the element headers,
+      // so the timestamp reads below do not stall on a cache miss for every element of the window
+      auto prefetch_iter = start_iter;
+      for (size_t i = 0; i < m_prefetch_distance && prefetch_iter.good(); ++i) {
+        ++prefetch_iter;
+        if (prefetch_iter.good()) {
+          _mm_prefetch(reinterpret_cast<const char*>(&(*prefetch_iter)), _MM_HINT_T0); // NOLINT
+        }
+      }
+
       RDT* element = &(*start_iter);
    
       while (start_iter.good() && element->get_timestamp() < end_win_ts) {
+        if (m_prefetch_distance > 0 && prefetch_iter.good()) {
+          ++prefetch_iter;
+          if (prefetch_iter.good()) {
+            _mm_prefetch(reinterpret_cast<const char*>(&(*prefetch_iter)), _MM_HINT_T0); // NOLINT
+          }
+        }
         if ( element->get_timestamp() + element->get_num_frames() * RDT::expected_tick_difference <= start_win_ts) {
         //TLOG() << "skip processing for current element " << element->get_timestamp() << ", out of readout window.";
         } 
@@ -502,13 +1374,7 @@ DefaultRequestHandlerModel<RDT, LBT>::get_fragment_pieces(uint64_t start_win_ts,
           element->get_timestamp() + element->get_num_frames() * RDT::expected_tick_difference >
             end_win_ts)) {
           //TLOG() << "We don't need the whole aggregated object (e.g.: superchunk)" ;
-          for (auto frame_iter = element->begin(); frame_iter != element->end(); frame_iter++) {
-            if (get_frame_iterator_timestamp(frame_iter) > (start_win_ts - RDT::expected_tick_difference)&&
-                get_frame_iterator_timestamp(frame_iter) < end_win_ts ) {
-              frag_pieces.emplace_back(
-                std::make_pair<void*, size_t>(static_cast<void*>(&(*frame_iter)), element->get_frame_size()));
-            }
-          }
+          add_partial_element_pieces(element, start_win_ts, end_win_ts, frag_pieces);
         }
         else {
 	  //TLOG() << "Add element " << element->get_timestamp();      
@@ -521,12 +1387,52 @@ DefaultRequestHandlerModel<RDT, LBT>::get_fragment_pieces(uint64_t start_win_ts,
         ++start_iter;
         element = &(*start_iter);
       }
+      m_request_stage_latency[kPieceExtraction].record_since(t_extraction, std::chrono::high_resolution_clock::now());
     }
   }
   TLOG_DEBUG(TLVL_WORK_STEPS) << "*** Number of frames retrieved: " << frag_pieces.size();
   return frag_pieces;
 }
 
+template<class RDT, class LBT>
+void
+DefaultRequestHandlerModel<RDT, LBT>::add_partial_element_pieces(RDT* element,
+                                                                 uint64_t start_win_ts,
+                                                                 uint64_t end_win_ts,
+                                                                 std::vector<std::pair<void*, size_t>>& frag_pieces)
+{
+  if constexpr (std::is_pointer_v<decltype(element->begin())>) {
+    // Frames are contiguous and expected to be RDT::expected_tick_difference apart, so the first frame with
+    // ts > start_win_ts - tick and the first frame with ts >= end_win_ts follow from the element timestamp.
+    const uint64_t tick = RDT::expected_tick_difference;           // NOLINT(build/unsigned)
+    const uint64_t element_ts = element->get_timestamp();          // NOLINT(build/unsigned)
+    const uint64_t num_frames = element->get_num_frames();         // NOLINT(build/unsigned)
+    uint64_t first = start_win_ts > element_ts ? (start_win_ts - element_ts) / tick : 0; // NOLINT(build/unsigned)
+    uint64_t last = end_win_ts > element_ts ? (end_win_ts - element_ts + tick - 1) / tick : 0; // NOLINT(build/unsigned)
+    last = std::min(last, num_frames);
+    if (first >= last) {
+      return;
+    }
+    auto first_frame = element->begin() + first;
+    auto last_frame = element->begin() + (last - 1);
+    // Verify the assumption once per element edge, fall back to inspecting every frame if it does not hold
+    if (sizeof(*first_frame) == element->get_frame_size() &&
+        get_frame_iterator_timestamp(first_frame) == element_ts + first * tick &&
+        get_frame_iterator_timestamp(last_frame) == element_ts + (last - 1) * tick) {
+      frag_pieces.emplace_back(static_cast<void*>(&(*first_frame)), (last - first) * element->get_frame_size());
+      return;
+    }
+  }
+
+  for (auto frame_iter = element->begin(); frame_iter != element->end(); frame_iter++) {
+    if (get_frame_iterator_timestamp(frame_iter) > (start_win_ts - RDT::expected_tick_difference)&&
+        get_frame_iterator_timestamp(frame_iter) < end_win_ts ) {
+      frag_pieces.emplace_back(
+        std::make_pair<void*, size_t>(static_cast<void*>(&(*frame_iter)), element->get_frame_size()));
+    }
+  }
+}
+
 template<class RDT, class LBT>
 typename DefaultRequestHandlerModel<RDT, LBT>::RequestResult 
 DefaultRequestHandlerModel<RDT, LBT>::data_request(dfmessages::DataRequest dr)
@@ -596,11 +1502,10 @@ DefaultRequestHandlerModel<RDT, LBT>::data_request(dfmessages::DataRequest dr)
 		frag_header.error_bits |= (0x1 << static_cast<size_t>(daqdataformats::FragmentErrorBits::kDataNotFound));
     }
   }
-  // Create fragment from pieces
-  rres.fragment = std::make_unique<daqdataformats::Fragment>(frag_pieces);
-
-  // Set header
-  rres.fragment->set_header_fields(frag_header);
+  // Create fragment from pieces and set header
+  auto t_build = std::chrono::high_resolution_clock::now();
+  rres.fragment = build_fragment(frag_pieces, frag_header);
+  m_request_stage_latency[kFragmentBuild].record_since(t_build, std::chrono::high_resolution_clock::now());
 
   return rres;
 }
@@ -214,11 +214,34 @@ template<class T>
 void 
 IterableQueueModel<T>::pop(std::size_t x)
 {
-  for (std::size_t i = 0; i < x; i++) {
-    popFront();
+  if constexpr (std::is_trivially_destructible_v<T>) {
+    // Nothing to destroy, so the read index can be moved in one step
+    assert(x <= occupancy());
+    auto nextRecord = readIndex_.load(std::memory_order_relaxed) + x;
+    if (nextRecord >= size_) {
+      nextRecord -= size_;
+    }
+    readIndex_.store(nextRecord, std::memory_order_release);
+  } else {
+    for (std::size_t i = 0; i < x; i++) {
+      popFront();
+    }
   }
 }
 
+// Number of elements between the front of the queue and the given iterator
+template<class T>
+std::size_t
+IterableQueueModel<T>::elements_before(Iterator& iter)
+{
+  if (!iter.good()) {
+    return occupancy();
+  }
+  auto const currentRead = readIndex_.load(std::memory_order_relaxed);
+  auto const index = iter.get_index();
+  return index >= currentRead ? index - currentRead : index + size_ - currentRead;
+}
+
 // Returns true if the queue is empty
 template<class T>
 bool 
@@ -28,6 +28,7 @@ RecorderModel<ReadoutType>::generate_opmon_data()
    info.set_recording_status("Y");
    info.set_packets_recorded(m_packets_processed.exchange(0));
    info.set_bytes_recorded(m_bytes_processed.exchange(0));
+   publish(std::move(info));
 }
 
 template<class ReadoutType>
@@ -39,8 +40,18 @@ RecorderModel<ReadoutType>::do_conf(const nlohmann::json& /* args */)
     TLOG(TLVL_WORK_STEPS) << "Removed existing output file from previous run" << std::endl;
   }
 
-  m_buffered_writer.open(
-    m_output_file, m_stream_buffer_size, m_compression_algorithm, m_use_o_direct);
+  m_batched = m_batch_elements > 0 && m_compression_algorithm == "None";
+  if (m_batch_elements > 0 && !m_batched) {
+    TLOG() << "Batched recording is only available without compression, writing element by element";
+  }
+  if (m_batched) {
+    m_batch_writer.set_timestamp_index(sizeof(ReadoutType), 0, m_index_interval_bytes);
+    m_batch_writer.open(m_output_file, m_batch_elements * sizeof(ReadoutType), m_use_o_direct);
+  } else {
+    m_buffered_writer.set_timestamp_index(sizeof(ReadoutType), 0, m_index_interval_bytes);
+    m_buffered_writer.open(
+      m_output_file, m_stream_buffer_size, m_compression_algorithm, m_use_o_direct);
+  }
   m_work_thread.set_name(m_name, 0);
 }
 
@@ -70,12 +81,16 @@ void
 RecorderModel<ReadoutType>::do_work()
 {
   m_time_point_last_info = std::chrono::steady_clock::now();
+  if (m_batched) {
+    do_batched_work();
+    return;
+  }
 
   ReadoutType element;
   while (m_run_marker) {
     try {
       element = m_data_receiver->receive(std::chrono::milliseconds(100)); // RS -> Use confed timeout?
-      if (!m_buffered_writer.write(reinterpret_cast<char*>(&element), sizeof(element))) { // NOLINT
+      if (!m_buffered_writer.write(reinterpret_cast<char*>(&element), sizeof(element), element.get_timestamp())) { // NOLINT
         ers::warning(CannotWriteToFile(ERS_HERE, m_output_file));
         break;
       }
@@ -88,5 +103,32 @@ RecorderModel<ReadoutType>::do_work()
   m_buffered_writer.flush();
 }
 
+template<class ReadoutType>
+void
+RecorderModel<ReadoutType>::do_batched_work()
+{
+  while (m_run_marker) {
+    // Block for the first element of a batch, then take whatever is already queued
+    size_t received = 0;
+    while (received < m_batch_elements) {
+      auto element = m_data_receiver->try_receive(received == 0 ? std::chrono::milliseconds(100)
+                                                                : std::chrono::milliseconds(0));
+      if (!element) {
+        break;
+      }
+      std::memcpy(m_batch_writer.reserve(sizeof(ReadoutType)), &*element, sizeof(ReadoutType));
+      m_batch_writer.commit(sizeof(ReadoutType), element->get_timestamp());
+      ++received;
+    }
+    m_packets_processed += received;
+    m_bytes_processed += received * sizeof(ReadoutType);
+    if (received < m_batch_elements) {
+      // The input is idle, do not hold back a partial batch
+      m_batch_writer.hand_off();
+    }
+  }
+  m_batch_writer.hand_off();
+}
+
 } // namespace datahandlinglibs
 } // namespace dunedaq
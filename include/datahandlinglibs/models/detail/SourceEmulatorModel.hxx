@@ -24,6 +24,7 @@ SourceEmulatorModel<ReadoutType>::set_sender(const std::string& conn_name)
 {
   if (!m_sender_is_set) {
     m_raw_data_sender = get_iom_sender<ReadoutType>(conn_name);
+    m_raw_data_connection_name = conn_name;
     m_sender_is_set = true;
   } else {
     // ers::error();
@@ -52,7 +53,8 @@ SourceEmulatorModel<ReadoutType>::conf(const confmodel::DetectorStream* link_con
     m_linkid = link_conf->get_geo_id()->get_stream_id();
 
     m_t0_now = emu_params->get_set_t0();
-    m_file_source = std::make_unique<FileSourceBuffer>(emu_params->get_input_file_size_limit(), sizeof(ReadoutType));
+    m_file_source = std::make_unique<FileSourceBuffer>(
+      emu_params->get_input_file_size_limit(), sizeof(ReadoutType), m_use_huge_pages);
     try {
       m_file_source->read(emu_params->get_data_file_name());
     } catch (const ers::Issue& ex) {
@@ -102,7 +104,12 @@ SourceEmulatorModel<ReadoutType>::start(const nlohmann::json& /*args*/)
   m_packet_count_tot = 0;
   TLOG_DEBUG(TLVL_WORK_STEPS) << "Starting threads...";
   // FIXME: don't know where to take the slowdown from... m_rate_limiter = std::make_unique<RateLimiter>(m_rate_khz / m_link_conf.slowdown);
-  m_rate_limiter = std::make_unique<RateLimiter>(m_rate_khz);
+  // The consumer registers its callback at conf, so it is looked up here rather than in set_sender
+  if (m_raw_data_connection_name.rfind("cb_", 0) == 0) {
+    m_raw_data_callback = DataMoveCallbackRegistry::get()->get_callback<ReadoutType>(m_raw_data_connection_name);
+  }
+  // One rate limiter period per batch of ticks
+  m_rate_limiter = std::make_unique<RateLimiter>(m_rate_khz / std::max<uint16_t>(m_batch_ticks, 1)); // NOLINT(build/unsigned)
   // m_stats_thread.set_work(&SourceEmulatorModel<ReadoutType>::run_stats, this);
   m_producer_thread.set_work(&SourceEmulatorModel<ReadoutType>::run_produce, this);
 }
@@ -145,7 +152,10 @@ SourceEmulatorModel<ReadoutType>::run_produce()
     num_elem = m_file_source->num_elements();
   }
 
-  auto rptr = reinterpret_cast<ReadoutType*>(source.data()); // NOLINT
+  // The file is mapped read-only, so the frames are only ever copied out of it
+  ReadoutType first_element;
+  ::memcpy(static_cast<void*>(&first_element), static_cast<const void*>(source.data()), sizeof(ReadoutType));
+  auto rptr = &first_element;
 
   // set the initial timestamp to a configured value, otherwise just use the timestamp from the header
   uint64_t ts_0 = rptr->get_timestamp(); // NOLINT(build/unsigned)
@@ -162,80 +172,83 @@ SourceEmulatorModel<ReadoutType>::run_produce()
   uint64_t timestamp = ts_0; // NOLINT(build/unsigned)
   int dropout_index = 0;
 
+  // Everything a batch needs is allocated once, the loop below only copies and patches frames
+  const std::size_t batch_ticks = std::max<uint16_t>(m_batch_ticks, 1); // NOLINT(build/unsigned)
+  std::vector<ReadoutType> batch(batch_ticks * m_frames_per_tick);
+  std::vector<uint64_t> batch_timestamps(batch.size()); // NOLINT(build/unsigned)
+  std::vector<uint16_t> frame_errs(rptr->get_num_frames()); // NOLINT(build/unsigned)
+  const uint64_t tick_diff = m_time_tick_diff * rptr->get_num_frames(); // NOLINT(build/unsigned)
+
   while (m_run_marker.load()) {
-    // TLOG() << "Generating " << m_frames_per_tick << " for TS " << timestamp;
-    for (uint16_t i = 0; i < m_frames_per_tick; i++) {
-      // Which element to push to the buffer
-      if (offset == num_elem || (offset + 1) * sizeof(ReadoutType) > source.size()) {
-        offset = 0;
-      }
+    // Copy the frames of the batch out of the file buffer, skipping dropouts
+    std::size_t count = 0;
+    for (std::size_t tick = 0; tick < batch_ticks; ++tick) {
+      for (uint16_t i = 0; i < m_frames_per_tick; i++) { // NOLINT(build/unsigned)
+        // Which element to push to the buffer
+        if (offset == num_elem || (offset + 1) * sizeof(ReadoutType) > source.size()) {
+          offset = 0;
+        }
 
-      bool create_frame = m_dropouts[dropout_index]; // NOLINT(runtime/threadsafe_fn)
-      dropout_index = (dropout_index + 1) % m_dropouts.size();
-      if (create_frame) {
-        ReadoutType payload;
-        // Memcpy from file buffer to flat char array
-        ::memcpy(static_cast<void*>(&payload),
-                 static_cast<void*>(source.data() + offset * sizeof(ReadoutType)),
-                 sizeof(ReadoutType));
-
-        // Fake timestamp
-        payload.fake_timestamps(timestamp, m_time_tick_diff);
-
-        // Fake geoid
-        payload.fake_geoid(m_crateid, m_slotid, m_linkid);
-
-        // Introducing frame errors
-        std::vector<uint16_t> frame_errs; // NOLINT(build/unsigned)
-        for (size_t i = 0; i < rptr->get_num_frames(); ++i) {
-          frame_errs.push_back(m_error_bit_generator.next());
+        bool create_frame = m_dropouts[dropout_index]; // NOLINT(runtime/threadsafe_fn)
+        dropout_index = (dropout_index + 1) % m_dropouts.size();
+        if (create_frame) {
+          ::memcpy(static_cast<void*>(&batch[count]),
+                   static_cast<const void*>(source.data() + offset * sizeof(ReadoutType)),
+                   sizeof(ReadoutType));
+          batch_timestamps[count] = timestamp;
+          ++count;
+          ++offset;
         }
-        payload.fake_frame_errors(&frame_errs);
-
-        if (m_generate_periodic_adc_pattern) { 
-          if (timestamp - m_pattern_generator_previous_ts > m_time_to_wait) {
-      
-            /* Reset the pattern from the beginning if it reaches the maximum
-            m_pattern_index++;
-            if (m_pattern_index == m_pattern_generator.get_total_size()) {
-              m_pattern_index = 0;
-            }
-            */
-            // Set the ADC to the uint16 maximum value
-            try {
-              payload.fake_adc_pattern(m_pattern_generator.get_channel_number());
-            }
-            catch (std::exception & ex) {
-              //FIXME: should not happen
-            }
-            
-            //TLOG() << "Lift channel " << channel;
-            
-            // Update the previous timestamp of the pattern generator
-            m_pattern_generator_previous_ts = timestamp;      
-            
-          } // timestamp difference
+      }
+      timestamp += tick_diff;
+    }
+
+    // Patch timestamps, geoid and errors in place
+    for (std::size_t i = 0; i < count; ++i) {
+      auto& payload = batch[i];
+      payload.fake_timestamps(batch_timestamps[i], m_time_tick_diff);
+      payload.fake_geoid(m_crateid, m_slotid, m_linkid);
+      for (auto& err : frame_errs) {
+        err = m_error_bit_generator.next();
+      }
+      payload.fake_frame_errors(&frame_errs);
+    }
+
+    if (m_generate_periodic_adc_pattern) {
+      for (std::size_t i = 0; i < count; ++i) {
+        if (batch_timestamps[i] - m_pattern_generator_previous_ts > m_time_to_wait) {
+          // Set the ADC to the uint16 maximum value
+          try {
+            batch[i].fake_adc_pattern(m_pattern_generator.get_channel_number());
+          }
+          catch (std::exception & ex) {
+            //FIXME: should not happen
+          }
+          // Update the previous timestamp of the pattern generator
+          m_pattern_generator_previous_ts = batch_timestamps[i];
         }
+      }
+    }
 
-        // send it
+    // send them, straight to the consumer if it registered a callback
+    if (m_raw_data_callback) {
+      for (std::size_t i = 0; i < count; ++i) {
+        (*m_raw_data_callback)(std::move(batch[i]));
+      }
+    } else {
+      for (std::size_t i = 0; i < count; ++i) {
         try {
-          m_raw_data_sender->send(std::move(payload), m_raw_sender_timeout_ms);
+          m_raw_data_sender->send(std::move(batch[i]), m_raw_sender_timeout_ms);
         } catch (ers::Issue& excpt) {
           ers::warning(CannotWriteToQueue(ERS_HERE, m_sourceid, "raw data input queue", excpt));
           // std::runtime_error("Queue timed out...");
         }
-
-        // Count packet and limit rate if needed.
-        ++offset;
-        ++m_packet_count;
-        ++m_packet_count_tot;
-
-
       }
     }
-    timestamp += m_time_tick_diff * rptr->get_num_frames();
-
 
+    // Count packets and limit rate if needed.
+    m_packet_count += count;
+    m_packet_count_tot += count;
 
     m_rate_limiter->limit();
   }
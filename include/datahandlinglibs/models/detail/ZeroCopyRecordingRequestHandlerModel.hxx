@@ -27,24 +27,60 @@ ZeroCopyRecordingRequestHandlerModel<ReadoutType, LatencyBufferType>::conf(const
         ers::error(ConfigurationError(ERS_HERE, inherited::m_sourceid, "Streaming chunk size is not divisible by 4kB!"));
       }
   
-      // Prepare filename with full path 
-      std::string file_full_path = data_rec_conf->get_output_file() + inherited::m_sourceid.to_string() + std::string(".bin");
-      inherited::m_output_file = file_full_path;
-
-  
-      // RS: This will need to go away with the SNB store handler!
-      if (std::remove(file_full_path.c_str()) == 0) {
-        TLOG(TLVL_WORK_STEPS) << "Removed existing output file from previous run: " << file_full_path;
+      // Prepare filenames with full path. A comma separated list of output paths stripes the
+      // recording over one file per path, in units of the streaming chunk size.
+      std::vector<std::string> output_paths;
+      std::stringstream output_list(data_rec_conf->get_output_file());
+      std::string output_path;
+      while (std::getline(output_list, output_path, ',')) {
+        if (!output_path.empty()) {
+          output_paths.push_back(output_path);
+        }
       }
-  
+      if (output_paths.empty()) {
+        // Only separators: write to the working directory, as with an empty prefix
+        output_paths.push_back("");
+      }
+      std::vector<std::string> file_full_paths;
+      if (output_paths.size() > 1) {
+        StripeManifest manifest;
+        manifest.stripe_size = inherited::m_stream_buffer_size;
+        for (std::size_t i = 0; i < output_paths.size(); ++i) {
+          file_full_paths.push_back(output_paths[i] + inherited::m_sourceid.to_string() + ".stripe" +
+                                    std::to_string(i) + std::string(".bin"));
+        }
+        manifest.files = file_full_paths;
+        inherited::m_output_file = output_paths[0] + inherited::m_sourceid.to_string() + StripeManifest::s_suffix;
+        if (!manifest.write(inherited::m_output_file)) {
+          throw ConfigurationError(ERS_HERE, inherited::m_sourceid, "Failed to write stripe manifest!");
+        }
+        TLOG(TLVL_WORK_STEPS) << "Striping recording over " << file_full_paths.size() << " files, manifest "
+                              << inherited::m_output_file;
+      } else {
+        file_full_paths.push_back(output_paths[0] + inherited::m_sourceid.to_string() + std::string(".bin"));
+        inherited::m_output_file = file_full_paths[0];
+      }
+
+      std::remove((inherited::m_output_file + ".gaps").c_str());
+
       m_oflag = O_CREAT | O_WRONLY;
       if (data_rec_conf->get_use_o_direct()) {
         m_oflag |= O_DIRECT;
       }
-      m_fd = ::open(file_full_path.c_str(), m_oflag, 0644);
-      if (m_fd == -1) {
-        TLOG() << "Failed to open file!";
-        throw ConfigurationError(ERS_HERE, inherited::m_sourceid, "Failed to open file!");
+      close_files();
+      m_file_offset = 0;
+      for (const auto& file_full_path : file_full_paths) {
+        // RS: This will need to go away with the SNB store handler!
+        if (std::remove(file_full_path.c_str()) == 0) {
+          TLOG(TLVL_WORK_STEPS) << "Removed existing output file from previous run: " << file_full_path;
+        }
+
+        int fd = ::open(file_full_path.c_str(), m_oflag, 0644);
+        if (fd == -1) {
+          TLOG() << "Failed to open file!";
+          throw ConfigurationError(ERS_HERE, inherited::m_sourceid, "Failed to open file!");
+        }
+        m_fds.push_back(fd);
       }
       inherited::m_recording_configured = true;
 
@@ -58,6 +94,24 @@ ZeroCopyRecordingRequestHandlerModel<ReadoutType, LatencyBufferType>::conf(const
   inherited::conf(conf);
 }
 
+template<class ReadoutType, class LatencyBufferType>
+void
+ZeroCopyRecordingRequestHandlerModel<ReadoutType, LatencyBufferType>::scrap(const nlohmann::json& args)
+{
+  close_files();
+  inherited::scrap(args);
+}
+
+template<class ReadoutType, class LatencyBufferType>
+unsigned
+ZeroCopyRecordingRequestHandlerModel<ReadoutType, LatencyBufferType>::uring_queue_depth(const nlohmann::json& args) const
+{
+  if (args.contains("uring_queue_depth")) {
+    return args["uring_queue_depth"].get<unsigned>();
+  }
+  return m_uring_queue_depth;
+}
+
 // Special record command that writes to files from memory aligned LBs
 template<class ReadoutType, class LatencyBufferType>
 void 
@@ -82,9 +136,14 @@ ZeroCopyRecordingRequestHandlerModel<ReadoutType, LatencyBufferType>::record(con
       CommandError(ERS_HERE, inherited::m_sourceid, "Recording for 0 seconds requested. Recording command is ignored!"));
     return;
   }
+  if (m_fds.empty()) {
+    ers::error(CommandError(ERS_HERE, inherited::m_sourceid, "No output file is open, recording command is ignored!"));
+    return;
+  }
+  unsigned queue_depth = uring_queue_depth(cmdargs);
 
   inherited::m_recording_thread.set_work(
-    [&](int duration) {
+    [&, queue_depth](int duration) {
       size_t chunk_size = inherited::m_stream_buffer_size;
       size_t alignment_size = inherited::m_latency_buffer->get_alignment_size();
       TLOG() << "Start recording for " << duration << " second(s)" << std::endl;
@@ -102,6 +161,15 @@ ZeroCopyRecordingRequestHandlerModel<ReadoutType, LatencyBufferType>::record(con
       size_t bytes_written = 0;
       size_t failed_writes = 0;
 
+      // Chunks are written straight out of the latency buffer, which is registered with the kernel.
+      // The files stay open between recordings, each one continues where the previous one ended.
+      m_writer.open(m_fds,
+                    inherited::m_stream_buffer_size,
+                    queue_depth,
+                    start_of_buffer_pointer,
+                    end_of_buffer_pointer - start_of_buffer_pointer,
+                    m_file_offset);
+
       while (std::chrono::duration_cast<std::chrono::seconds>(current_time - start_of_recording).count() < duration) {
         if (!inherited::m_cleanup_requested || (inherited::m_next_timestamp_to_record == 0)) {
           size_t considered_chunks_in_loop = 0;
@@ -138,6 +206,8 @@ ZeroCopyRecordingRequestHandlerModel<ReadoutType, LatencyBufferType>::record(con
             }
             TLOG() << "Skipped " << skipped_frames << " frames";
             current_write_pointer = reinterpret_cast<const char*>(&(*begin)); // NOLINT
+          } else if (current_write_pointer != nullptr) {
+            skip_if_behind(current_write_pointer, failed_writes);
           }
 
           current_end_pointer = reinterpret_cast<const char*>(inherited::m_latency_buffer->back()); // NOLINT
@@ -152,7 +222,7 @@ ZeroCopyRecordingRequestHandlerModel<ReadoutType, LatencyBufferType>::record(con
             bool failed_write = false;
             if (current_write_pointer + chunk_size < current_end_pointer) {
               // We can write a whole chunk to file
-              failed_write |= !::write(m_fd, current_write_pointer, chunk_size);
+              failed_write |= !m_writer.write(current_write_pointer, chunk_size);
               if (!failed_write) {
                 bytes_written += chunk_size;
               }
@@ -160,17 +230,18 @@ ZeroCopyRecordingRequestHandlerModel<ReadoutType, LatencyBufferType>::record(con
             } else if (current_end_pointer < current_write_pointer) {
               if (current_write_pointer + chunk_size < end_of_buffer_pointer) {
                 // Write whole chunk to file
-                failed_write |= !::write(m_fd, current_write_pointer, chunk_size);
+                failed_write |= !m_writer.write(current_write_pointer, chunk_size);
                 if (!failed_write) {
                   bytes_written += chunk_size;
                 }
                 current_write_pointer += chunk_size;
               } else {
                 // Write the last bit of the buffer without using O_DIRECT as it possibly doesn't fulfill the
-                // alignment requirement
-                fcntl(m_fd, F_SETFL, O_CREAT | O_WRONLY);
-                failed_write |= !::write(m_fd, current_write_pointer, end_of_buffer_pointer - current_write_pointer);
-                fcntl(m_fd, F_SETFL, m_oflag);
+                // alignment requirement. The flags apply to writes in flight as well, so wait for them first.
+                failed_write |= !m_writer.drain();
+                set_file_flags(O_CREAT | O_WRONLY);
+                failed_write |= !m_writer.write_sync(current_write_pointer, end_of_buffer_pointer - current_write_pointer);
+                set_file_flags(m_oflag);
                 if (!failed_write) {
                   bytes_written += end_of_buffer_pointer - current_write_pointer;
                 }
@@ -187,11 +258,14 @@ ZeroCopyRecordingRequestHandlerModel<ReadoutType, LatencyBufferType>::record(con
               ers::warning(CannotWriteToFile(ERS_HERE, inherited::m_output_file));
             }
             considered_chunks_in_loop++;
-            // This expression is "a bit" complicated as it finds the last frame that was written to file completely
+            // This expression is "a bit" complicated as it finds the last frame that was written to file completely.
+            // Writes still in flight read from the buffer, so the oldest of them holds back cleanup.
+            const char* oldest_pending = static_cast<const char*>(m_writer.oldest_pending());
+            const char* completed_pointer = oldest_pending != nullptr ? oldest_pending : current_write_pointer;
             inherited::m_next_timestamp_to_record =
               reinterpret_cast<const ReadoutType*>( // NOLINT
                 start_of_buffer_pointer +
-                (((current_write_pointer - start_of_buffer_pointer) / ReadoutType::fixed_payload_size) *
+                (((completed_pointer - start_of_buffer_pointer) / ReadoutType::fixed_payload_size) *
                  ReadoutType::fixed_payload_size))
                 ->get_timestamp();
           }
@@ -205,18 +279,21 @@ ZeroCopyRecordingRequestHandlerModel<ReadoutType, LatencyBufferType>::record(con
           start_of_buffer_pointer +
           (((current_write_pointer - start_of_buffer_pointer) / ReadoutType::fixed_payload_size) *
            ReadoutType::fixed_payload_size);
+        if (!m_writer.drain()) {
+          ers::warning(CannotWriteToFile(ERS_HERE, inherited::m_output_file));
+        }
         if (last_started_frame != current_write_pointer) {
-          fcntl(m_fd, F_SETFL, O_CREAT | O_WRONLY);
-          if (!::write(m_fd,
-                       current_write_pointer,
-                       (last_started_frame + ReadoutType::fixed_payload_size) - current_write_pointer)) {
+          set_file_flags(O_CREAT | O_WRONLY);
+          if (!m_writer.write_sync(current_write_pointer,
+                                   (last_started_frame + ReadoutType::fixed_payload_size) - current_write_pointer)) {
             ers::warning(CannotWriteToFile(ERS_HERE, inherited::m_output_file));
           } else {
             bytes_written += (last_started_frame + ReadoutType::fixed_payload_size) - current_write_pointer;
           }
         }
       }
-      ::close(m_fd);
+      m_file_offset = m_writer.file_offset();
+      m_writer.close();
 
       inherited::m_next_timestamp_to_record = std::numeric_limits<uint64_t>::max(); // NOLINT (build/unsigned)
 
@@ -225,5 +302,227 @@ ZeroCopyRecordingRequestHandlerModel<ReadoutType, LatencyBufferType>::record(con
     }, recording_time_sec);
 }
 
+template<class ReadoutType, class LatencyBufferType>
+void
+ZeroCopyRecordingRequestHandlerModel<ReadoutType, LatencyBufferType>::dump(const nlohmann::json& args)
+{
+  uint64_t window_begin = 0; // NOLINT(build/unsigned)
+  uint64_t window_end = 0;   // NOLINT(build/unsigned)
+  std::string dump_file;
+  if (!inherited::parse_dump_args(args, window_begin, window_end, dump_file)) {
+    return;
+  }
+  unsigned queue_depth = uring_queue_depth(args);
+
+  // Writes have to start from an aligned element, which can be this many elements before the window
+  size_t alignment_size = std::max<size_t>(inherited::m_latency_buffer->get_alignment_size(), 1);
+  size_t elements_per_alignment = alignment_size / std::gcd(sizeof(ReadoutType), alignment_size);
+  uint64_t ticks_per_element = ReadoutType::expected_tick_difference * ReadoutType().get_num_frames(); // NOLINT(build/unsigned)
+  uint64_t lead_ticks = elements_per_alignment * ticks_per_element; // NOLINT(build/unsigned)
+  uint64_t first_ts = window_begin > lead_ticks ? window_begin - lead_ticks : 0; // NOLINT(build/unsigned)
+  // Taken right away, so cleanup cannot remove the window before the dump starts
+  auto lease = inherited::acquire_retention_lease(first_ts);
+  inherited::m_recording.exchange(true);
+  inherited::start_dump_progress();
+
+  bool started = inherited::m_recording_thread.set_work([this, window_begin, window_end, alignment_size,
+                                                         elements_per_alignment, ticks_per_element, dump_file, lease,
+                                                         queue_depth]() {
+    TLOG() << "Start dumping window [" << window_begin << ", " << window_end << ") to " << dump_file;
+    auto start_of_dump = std::chrono::steady_clock::now();
+    const char* start_of_buffer_pointer =
+      reinterpret_cast<const char*>(inherited::m_latency_buffer->start_of_buffer()); // NOLINT
+    const char* end_of_buffer_pointer = reinterpret_cast<const char*>(inherited::m_latency_buffer->end_of_buffer()); // NOLINT
+    size_t buffer_bytes = end_of_buffer_pointer - start_of_buffer_pointer;
+    // Distance of an element from the oldest one, following the ring
+    auto ring_distance = [&](const char* from, const char* to) {
+      return static_cast<size_t>((to - from + buffer_bytes) % buffer_bytes);
+    };
+
+    size_t bytes = 0;
+    size_t total_bytes = 0;
+    const char* begin_pointer = nullptr;
+    const char* end_pointer = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(inherited::m_cv_mutex);
+      inherited::m_cv.wait(lock, [&] { return !inherited::m_cleanup_requested; });
+      inherited::m_requests_running++;
+    }
+    inherited::m_cv.notify_all();
+    ReadoutType element_to_search;
+    element_to_search.set_timestamp(window_begin > ticks_per_element ? window_begin - ticks_per_element : 0);
+    auto first = inherited::m_latency_buffer->lower_bound(element_to_search, false);
+    auto front = inherited::m_latency_buffer->front();
+    auto back = inherited::m_latency_buffer->back();
+    if (first != inherited::m_latency_buffer->end() && first.good() && front != nullptr && back != nullptr &&
+        first->get_timestamp() < window_end) {
+      const char* front_pointer = reinterpret_cast<const char*>(front); // NOLINT
+      const char* first_pointer = reinterpret_cast<const char*>(&(*first)); // NOLINT
+      // Step back to the closest aligned element that is still in the buffer, or else forward to the next one
+      size_t first_index = (first_pointer - start_of_buffer_pointer) / sizeof(ReadoutType);
+      const char* aligned_pointer =
+        start_of_buffer_pointer + (first_index - first_index % elements_per_alignment) * sizeof(ReadoutType);
+      if (ring_distance(front_pointer, aligned_pointer) > ring_distance(front_pointer, first_pointer)) {
+        aligned_pointer += elements_per_alignment * sizeof(ReadoutType);
+        if (aligned_pointer == end_of_buffer_pointer) {
+          aligned_pointer = start_of_buffer_pointer;
+        }
+        TLOG() << "The start of the dump window is not aligned in the buffer anymore, skipping "
+               << ring_distance(first_pointer, aligned_pointer) / sizeof(ReadoutType) << " elements";
+      }
+      begin_pointer = aligned_pointer;
+
+      element_to_search.set_timestamp(window_end);
+      auto last = inherited::m_latency_buffer->lower_bound(element_to_search, false);
+      end_pointer = last != inherited::m_latency_buffer->end() && last.good()
+                      ? reinterpret_cast<const char*>(&(*last))          // NOLINT
+                      : reinterpret_cast<const char*>(back) + sizeof(ReadoutType); // NOLINT
+      if (end_pointer == end_of_buffer_pointer) {
+        end_pointer = start_of_buffer_pointer;
+      }
+      if (ring_distance(front_pointer, begin_pointer) < ring_distance(front_pointer, end_pointer)) {
+        total_bytes = ring_distance(begin_pointer, end_pointer);
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(inherited::m_cv_mutex);
+      inherited::m_requests_running--;
+    }
+    inherited::m_cv.notify_all();
+
+    int fd = -1;
+    if (total_bytes > 0) {
+      std::remove(dump_file.c_str());
+      fd = ::open(dump_file.c_str(), m_oflag, 0644);
+      if (fd == -1) {
+        ers::error(CannotWriteToFile(ERS_HERE, dump_file));
+      }
+    }
+    if (fd != -1) {
+      UringFileWriter writer;
+      writer.open(fd, queue_depth, start_of_buffer_pointer, buffer_bytes);
+      const char* current_pointer = begin_pointer;
+      bool failed_write = false;
+      while (bytes < total_bytes && !failed_write) {
+        const char* limit = end_pointer > current_pointer ? end_pointer : end_of_buffer_pointer;
+        size_t chunk_size = std::min<size_t>(inherited::m_stream_buffer_size, limit - current_pointer);
+        // Whole multiples of the buffer alignment keep both the memory and the file offset aligned
+        if (chunk_size % alignment_size == 0) {
+          failed_write = !writer.write(current_pointer, chunk_size);
+        } else {
+          // The end of the window possibly doesn't fulfill the O_DIRECT alignment requirement
+          failed_write = !writer.drain();
+          fcntl(fd, F_SETFL, O_CREAT | O_WRONLY);
+          failed_write |= !writer.write_sync(current_pointer, chunk_size);
+          fcntl(fd, F_SETFL, m_oflag);
+        }
+        current_pointer += chunk_size;
+        if (current_pointer == end_of_buffer_pointer) {
+          current_pointer = start_of_buffer_pointer;
+        }
+        bytes += chunk_size;
+        inherited::m_bytes_written += chunk_size;
+
+        // Data that reached the file no longer needs to stay in the buffer
+        const char* oldest_pending = static_cast<const char*>(writer.oldest_pending());
+        const char* completed_pointer = oldest_pending != nullptr ? oldest_pending : current_pointer;
+        if (completed_pointer != end_pointer) {
+          inherited::update_retention_lease(
+            lease,
+            reinterpret_cast<const ReadoutType*>( // NOLINT
+              start_of_buffer_pointer + ((completed_pointer - start_of_buffer_pointer) / sizeof(ReadoutType)) *
+                                          sizeof(ReadoutType))
+              ->get_timestamp());
+        }
+        inherited::update_dump_progress(bytes, static_cast<double>(bytes) / total_bytes, start_of_dump);
+      }
+      if (!writer.drain() || failed_write) {
+        ers::warning(CannotWriteToFile(ERS_HERE, dump_file));
+      }
+      writer.close();
+      ::close(fd);
+    }
+    inherited::release_retention_lease(lease);
+    inherited::update_dump_progress(bytes, total_bytes > 0 ? static_cast<double>(bytes) / total_bytes : 0, start_of_dump);
+
+    TLOG() << "Dumped " << bytes << " bytes of window [" << window_begin << ", " << window_end << ") at "
+           << inherited::m_dump_rate.load() << " MB/s";
+    inherited::m_dumping = false;
+    inherited::m_recording.exchange(false);
+  });
+  if (!started) {
+    ers::error(CommandError(ERS_HERE, inherited::m_sourceid, "The recording thread is busy, no dump was started!"));
+    inherited::release_retention_lease(lease);
+    inherited::m_dumping = false;
+    inherited::m_recording.exchange(false);
+  }
+}
+
+template<class ReadoutType, class LatencyBufferType>
+void
+ZeroCopyRecordingRequestHandlerModel<ReadoutType, LatencyBufferType>::skip_if_behind(const char*& current_write_pointer,
+                                                                                     size_t& failed_writes)
+{
+  auto skip_target = inherited::recording_skip_target();
+  if (skip_target <= inherited::m_next_timestamp_to_record) {
+    return;
+  }
+  // Writes in flight read from the data that is about to be given up
+  if (!m_writer.drain()) {
+    ++failed_writes;
+    ers::warning(CannotWriteToFile(ERS_HERE, inherited::m_output_file));
+  }
+
+  const char* start_of_buffer_pointer = reinterpret_cast<const char*>(inherited::m_latency_buffer->start_of_buffer()); // NOLINT
+  const char* end_of_buffer_pointer = reinterpret_cast<const char*>(inherited::m_latency_buffer->end_of_buffer()); // NOLINT
+  size_t buffer_bytes = end_of_buffer_pointer - start_of_buffer_pointer;
+  size_t alignment_size = std::max<size_t>(inherited::m_latency_buffer->get_alignment_size(), 1);
+  size_t elements_per_alignment = alignment_size / std::gcd(sizeof(ReadoutType), alignment_size);
+
+  ReadoutType element_to_search;
+  element_to_search.set_timestamp(skip_target);
+  auto target = inherited::m_latency_buffer->lower_bound(element_to_search, false);
+  auto back = inherited::m_latency_buffer->back();
+  if (target == inherited::m_latency_buffer->end() || !target.good() || back == nullptr) {
+    return;
+  }
+  // The file offset stays aligned as long as whole aligned pieces of the buffer are skipped
+  size_t target_index = (reinterpret_cast<const char*>(&(*target)) - start_of_buffer_pointer) / sizeof(ReadoutType); // NOLINT
+  size_t aligned_index = (target_index + elements_per_alignment - 1) / elements_per_alignment * elements_per_alignment;
+  const char* skip_pointer = start_of_buffer_pointer + aligned_index * sizeof(ReadoutType);
+  if (skip_pointer == end_of_buffer_pointer) {
+    skip_pointer = start_of_buffer_pointer;
+  }
+  auto ring_distance = [&](const char* to) {
+    return static_cast<size_t>((to - current_write_pointer + buffer_bytes) % buffer_bytes);
+  };
+  if (ring_distance(skip_pointer) >= ring_distance(reinterpret_cast<const char*>(back))) { // NOLINT
+    return;
+  }
+  uint64_t skipped_to = reinterpret_cast<const ReadoutType*>(skip_pointer)->get_timestamp(); // NOLINT
+  inherited::mark_recording_gap(inherited::m_next_timestamp_to_record, skipped_to);
+  current_write_pointer = skip_pointer;
+  inherited::m_next_timestamp_to_record = skipped_to;
+}
+
+template<class ReadoutType, class LatencyBufferType>
+void
+ZeroCopyRecordingRequestHandlerModel<ReadoutType, LatencyBufferType>::set_file_flags(int flags)
+{
+  for (int fd : m_fds) {
+    fcntl(fd, F_SETFL, flags);
+  }
+}
+
+template<class ReadoutType, class LatencyBufferType>
+void
+ZeroCopyRecordingRequestHandlerModel<ReadoutType, LatencyBufferType>::close_files()
+{
+  for (int fd : m_fds) {
+    ::close(fd);
+  }
+  m_fds.clear();
+}
+
 } // namespace datahandlinglibs
 } // namespace dunedaq
@@ -0,0 +1,252 @@
+/**
+ * @file AdcDeltaCodec.hpp Lossless block codec for detector frames carrying
+ * ADC waveforms. The ADC values are unpacked to 16 bits per channel, delta
+ * encoded along time and the zigzagged residuals are bit-packed in groups of
+ * 32 values with the width of the largest one. The frame layout is provided
+ * by an AdcCodecTraits specialization of the readout type.
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_ADCDELTACODEC_HPP_
+#define DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_ADCDELTACODEC_HPP_
+
+#include "datahandlinglibs/utils/ParallelBlockCompression.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace dunedaq {
+namespace datahandlinglibs {
+
+/**
+ * Frame layout used by the AdcDeltaCodec, to be specialized next to the readout type:
+ *
+ *   template<>
+ *   struct AdcCodecTraits<MyFrame>
+ *   {
+ *     static constexpr std::size_t num_channels = 64;
+ *     static constexpr std::size_t num_samples = 64; // Time samples per frame
+ *     static constexpr std::size_t rest_size = 32;   // Bytes of the frame that are not ADC values
+ *     // Unpack adcs[sample * num_channels + channel] and copy the other fields of the frame to rest
+ *     static void unpack(const MyFrame& frame, uint16_t* adcs, char* rest);
+ *     // Inverse of unpack, restoring the frame bit for bit
+ *     static void pack(const uint16_t* adcs, const char* rest, MyFrame& frame);
+ *   };
+ */
+template<class ReadoutType>
+struct AdcCodecTraits;
+
+/**
+ * Encoded block: the rest of every frame, one width byte per group of 32 residuals, per group
+ * as many 32-bit bit planes as its width (bit i of plane b is bit b of residual i), and the
+ * bytes of an incomplete frame at the end of the block unchanged. Residuals are taken along
+ * time per channel, across the frames of the block, starting from 0.
+ */
+template<class ReadoutType, class Traits = AdcCodecTraits<ReadoutType>>
+class AdcDeltaCodec : public BlockCodec
+{
+public:
+  static constexpr std::size_t s_group_size = 32;
+
+  std::string name() const override { return "adc-delta"; }
+
+  std::size_t block_alignment() const override { return sizeof(ReadoutType); }
+
+  std::vector<char> encode(const char* data, std::size_t size) const override
+  {
+    auto num_frames = size / sizeof(ReadoutType);
+    auto num_values = num_frames * s_frame_values;
+    auto num_groups = (num_values + s_group_size - 1) / s_group_size;
+    auto tail = size - num_frames * sizeof(ReadoutType);
+
+    // Scratch space is kept per thread, as fresh large allocations cost page faults on every block
+    thread_local std::vector<uint16_t> adcs;      // NOLINT(build/unsigned)
+    thread_local std::vector<uint16_t> residuals; // NOLINT(build/unsigned)
+    thread_local std::vector<char> rest;
+    adcs.resize(num_groups * s_group_size);
+    residuals.resize(adcs.size());
+    rest.resize(num_frames * Traits::rest_size);
+    for (std::size_t i = 0; i < num_frames; ++i) {
+      Traits::unpack(*reinterpret_cast<const ReadoutType*>(data + i * sizeof(ReadoutType)), // NOLINT
+                     adcs.data() + i * s_frame_values,
+                     rest.data() + i * Traits::rest_size);
+    }
+    delta_zigzag(adcs.data(), residuals.data(), num_values);
+    // The last group is padded with zero residuals
+    std::fill(residuals.begin() + num_values, residuals.end(), 0);
+
+    std::vector<char> encoded(rest.size() + num_groups);
+    std::size_t planes = 0;
+    for (std::size_t g = 0; g < num_groups; ++g) {
+      auto width = group_width(residuals.data() + g * s_group_size);
+      encoded[rest.size() + g] = static_cast<char>(width);
+      planes += width;
+    }
+    encoded.resize(encoded.size() + planes * sizeof(uint32_t) + tail); // NOLINT(build/unsigned)
+    std::memcpy(encoded.data(), rest.data(), rest.size());
+    const auto* widths = encoded.data() + rest.size();
+    auto* packed = encoded.data() + rest.size() + num_groups;
+    for (std::size_t g = 0; g < num_groups; ++g) {
+      pack_group(residuals.data() + g * s_group_size, widths[g], packed);
+      packed += widths[g] * sizeof(uint32_t); // NOLINT(build/unsigned)
+    }
+    std::memcpy(packed, data + num_frames * sizeof(ReadoutType), tail);
+    return encoded;
+  }
+
+  bool decode(const char* data, std::size_t size, std::vector<char>& decoded, std::size_t decoded_size) const override
+  {
+    auto num_frames = decoded_size / sizeof(ReadoutType);
+    auto num_values = num_frames * s_frame_values;
+    auto num_groups = (num_values + s_group_size - 1) / s_group_size;
+    auto tail = decoded_size - num_frames * sizeof(ReadoutType);
+
+    auto header_size = num_frames * Traits::rest_size + num_groups;
+    if (size < header_size) {
+      return false;
+    }
+    const auto* widths = reinterpret_cast<const uint8_t*>(data + num_frames * Traits::rest_size); // NOLINT
+    std::size_t planes = 0;
+    for (std::size_t g = 0; g < num_groups; ++g) {
+      if (widths[g] > 16) {
+        return false;
+      }
+      planes += widths[g];
+    }
+    if (size != header_size + planes * sizeof(uint32_t) + tail) { // NOLINT(build/unsigned)
+      return false;
+    }
+
+    thread_local std::vector<uint16_t> residuals; // NOLINT(build/unsigned)
+    residuals.resize(num_groups * s_group_size);
+    const char* packed = data + header_size;
+    for (std::size_t g = 0; g < num_groups; ++g) {
+      unpack_group(packed, widths[g], residuals.data() + g * s_group_size);
+      packed += widths[g] * sizeof(uint32_t); // NOLINT(build/unsigned)
+    }
+    undo_delta_zigzag(residuals.data(), num_values);
+
+    decoded.resize(decoded_size);
+    for (std::size_t i = 0; i < num_frames; ++i) {
+      Traits::pack(residuals.data() + i * s_frame_values,
+                   data + i * Traits::rest_size,
+                   *reinterpret_cast<ReadoutType*>(decoded.data() + i * sizeof(ReadoutType))); // NOLINT
+    }
+    std::memcpy(decoded.data() + num_frames * sizeof(ReadoutType), packed, tail);
+    return true;
+  }
+
+private:
+  static constexpr std::size_t s_frame_values = Traits::num_channels * Traits::num_samples;
+  static constexpr std::size_t s_channels = Traits::num_channels;
+
+  // residuals[i] = zigzag(adcs[i] - adcs[i - channels]), in 16-bit arithmetic so that any input round-trips.
+  // count is a multiple of the number of channels.
+  static void delta_zigzag(const uint16_t* adcs, uint16_t* residuals, std::size_t count) // NOLINT(build/unsigned)
+  {
+    for (std::size_t i = 0; i < s_channels && i < count; ++i) {
+      residuals[i] = zigzag(adcs[i]);
+    }
+    for (std::size_t i = s_channels; i < count; ++i) {
+      residuals[i] = zigzag(static_cast<uint16_t>(adcs[i] - adcs[i - s_channels])); // NOLINT(build/unsigned)
+    }
+  }
+
+  // In place inverse of delta_zigzag
+  static void undo_delta_zigzag(uint16_t* values, std::size_t count) // NOLINT(build/unsigned)
+  {
+    for (std::size_t i = 0; i < count; ++i) {
+      values[i] = static_cast<uint16_t>((values[i] >> 1) ^ static_cast<uint16_t>(-(values[i] & 1))); // NOLINT
+    }
+    for (std::size_t i = s_channels; i < count; ++i) {
+      values[i] = static_cast<uint16_t>(values[i] + values[i - s_channels]); // NOLINT(build/unsigned)
+    }
+  }
+
+  static uint16_t zigzag(uint16_t delta) // NOLINT(build/unsigned)
+  {
+    return static_cast<uint16_t>((delta << 1) ^ static_cast<uint16_t>(static_cast<int16_t>(delta) >> 15)); // NOLINT
+  }
+
+  static unsigned group_width(const uint16_t* values) // NOLINT(build/unsigned)
+  {
+    uint16_t all = 0; // NOLINT(build/unsigned)
+    for (std::size_t i = 0; i < s_group_size; ++i) {
+      all |= values[i];
+    }
+    return all == 0 ? 0 : 32 - __builtin_clz(all);
+  }
+
+  static void pack_group(const uint16_t* values, unsigned width, char* out) // NOLINT(build/unsigned)
+  {
+#if defined(__AVX2__)
+    __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values));       // NOLINT
+    __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + 16)); // NOLINT
+    for (unsigned b = 0; b < width; ++b) {
+      // Move bit b to the sign bit and spread it over the lane, then collect the signs of the 32 values
+      __m128i to_sign = _mm_cvtsi32_si128(15 - b);
+      __m256i low_bits = _mm256_srai_epi16(_mm256_sll_epi16(low, to_sign), 15);
+      __m256i high_bits = _mm256_srai_epi16(_mm256_sll_epi16(high, to_sign), 15);
+      __m256i bytes = _mm256_permute4x64_epi64(_mm256_packs_epi16(low_bits, high_bits), 0xD8);
+      uint32_t plane = static_cast<uint32_t>(_mm256_movemask_epi8(bytes)); // NOLINT(build/unsigned)
+      std::memcpy(out + b * sizeof(plane), &plane, sizeof(plane));
+    }
+#else
+    for (unsigned b = 0; b < width; ++b) {
+      uint32_t plane = 0; // NOLINT(build/unsigned)
+      for (std::size_t i = 0; i < s_group_size; ++i) {
+        plane |= static_cast<uint32_t>((values[i] >> b) & 1) << i; // NOLINT(build/unsigned)
+      }
+      std::memcpy(out + b * sizeof(plane), &plane, sizeof(plane));
+    }
+#endif
+  }
+
+  static void unpack_group(const char* in, unsigned width, uint16_t* values) // NOLINT(build/unsigned)
+  {
+#if defined(__AVX2__)
+    const __m256i lane_bits = _mm256_setr_epi16(0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
+                                                0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000,
+                                                static_cast<int16_t>(0x8000)); // NOLINT
+    __m256i low = _mm256_setzero_si256();
+    __m256i high = _mm256_setzero_si256();
+    for (unsigned b = 0; b < width; ++b) {
+      uint32_t plane; // NOLINT(build/unsigned)
+      std::memcpy(&plane, in + b * sizeof(plane), sizeof(plane));
+      __m256i bit = _mm256_set1_epi16(static_cast<int16_t>(1 << b));                                    // NOLINT
+      __m256i low_plane = _mm256_set1_epi16(static_cast<int16_t>(plane & 0xFFFF));                       // NOLINT
+      __m256i high_plane = _mm256_set1_epi16(static_cast<int16_t>(plane >> 16));                         // NOLINT
+      __m256i low_set = _mm256_cmpeq_epi16(_mm256_and_si256(low_plane, lane_bits), lane_bits);
+      __m256i high_set = _mm256_cmpeq_epi16(_mm256_and_si256(high_plane, lane_bits), lane_bits);
+      low = _mm256_or_si256(low, _mm256_and_si256(low_set, bit));
+      high = _mm256_or_si256(high, _mm256_and_si256(high_set, bit));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(values), low);       // NOLINT
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(values + 16), high); // NOLINT
+#else
+    std::memset(values, 0, s_group_size * sizeof(uint16_t)); // NOLINT(build/unsigned)
+    for (unsigned b = 0; b < width; ++b) {
+      uint32_t plane; // NOLINT(build/unsigned)
+      std::memcpy(&plane, in + b * sizeof(plane), sizeof(plane));
+      for (std::size_t i = 0; i < s_group_size; ++i) {
+        values[i] |= static_cast<uint16_t>(((plane >> i) & 1) << b); // NOLINT(build/unsigned)
+      }
+    }
+#endif
+  }
+};
+
+} // namespace datahandlinglibs
+} // namespace dunedaq
+
+#endif // DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_ADCDELTACODEC_HPP_
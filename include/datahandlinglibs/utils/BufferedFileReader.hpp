@@ -11,6 +11,9 @@
 
 #include "datahandlinglibs/DataHandlingIssues.hpp"
 #include "datahandlinglibs/ReadoutLogging.hpp"
+#include "datahandlinglibs/utils/ParallelBlockCompression.hpp"
+#include "datahandlinglibs/utils/StripedFile.hpp"
+#include "datahandlinglibs/utils/TimestampIndex.hpp"
 
 #include "logging/Logging.hpp"
 
@@ -23,12 +26,18 @@
 #include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/stream_buffer.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <fcntl.h>
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <utility>
 
 using dunedaq::datahandlinglibs::logging::TLVL_WORK_STEPS;
 
@@ -52,7 +61,9 @@ public:
    * Constructor to construct and initalize an instance. The file will be open after initialization.
    * @param filename The file to be used.
    * @param buffer_size The size of the buffer to be used.
-   * @param compression_algorithm The compression algorithm to use. Can be one of: None, zstd, lzma or zlib
+   * @param compression_algorithm The compression algorithm to use. Can be one of: None, zstd, zstd-parallel, lzma,
+   * zlib or the name of a codec registered with set_codec(). zstd-parallel and codecs decode blocks ahead on a pool
+   * of threads, see set_parallel_decompression().
    * @throw CannotOpenFile If the file can not be opened.
    * @throw ConfigurationError If the compression algorithm parameter is not recognized.
    */
@@ -66,16 +77,21 @@ public:
    */
   BufferedFileReader() {}
 
+  ~BufferedFileReader() { unmap(); }
+
   BufferedFileReader(const BufferedFileReader&) = delete;            ///< BufferedFileReader is not copy-constructible
   BufferedFileReader& operator=(const BufferedFileReader&) = delete; ///< BufferedFileReader is not copy-assginable
   BufferedFileReader(BufferedFileReader&&) = delete;                 ///< BufferedFileReader is not move-constructible
   BufferedFileReader& operator=(BufferedFileReader&&) = delete;      ///< BufferedFileReader is not move-assignable
 
   /**
-   * Open a file.
+   * Open a file. A striped recording is opened through its manifest (a file ending in ".manifest")
+   * and read as one stream.
    * @param filename The file to be used.
    * @param buffer_size The size of the buffer to be used.
-   * @param compression_algorithm The compression algorithm to use. Can be one of: None, zstd, lzma or zlib
+   * @param compression_algorithm The compression algorithm to use. Can be one of: None, zstd, zstd-parallel, lzma,
+   * zlib or the name of a codec registered with set_codec(). zstd-parallel and codecs decode blocks ahead on a pool
+   * of threads, see set_parallel_decompression().
    * @throw CannotOpenFile If the file can not be opened.
    * @throw ConfigurationError If the compression algorithm parameter is not recognized.
    */
@@ -84,33 +100,71 @@ public:
     m_filename = filename;
     m_buffer_size = buffer_size;
     m_compression_algorithm = compression_algorithm;
-
-    int fd = ::open(m_filename.c_str(), O_RDONLY);
-    if (fd == -1) {
-      throw BufferedReaderWriterCannotOpenFile(ERS_HERE, m_filename);
+    m_timestamp_index.entries.clear();
+    m_timestamp_index_loaded = false;
+    unmap();
+    if (m_use_mmap && m_compression_algorithm == "None" && !StripeManifest::is_manifest(m_filename)) {
+      open_mapping();
+      return;
     }
-
-    io_source_t io_source(fd, boost::iostreams::file_descriptor_flags::close_handle);
-    if (m_compression_algorithm == "zstd") {
-      TLOG_DEBUG(TLVL_WORK_STEPS) << "Using zstd compression" << std::endl;
-      m_input_stream.push(boost::iostreams::zstd_decompressor());
-    } else if (m_compression_algorithm == "lzma") {
-      TLOG_DEBUG(TLVL_WORK_STEPS) << "Using lzma compression" << std::endl;
-      m_input_stream.push(boost::iostreams::lzma_decompressor());
-    } else if (m_compression_algorithm == "zlib") {
-      TLOG_DEBUG(TLVL_WORK_STEPS) << "Using zlib compression" << std::endl;
-      m_input_stream.push(boost::iostreams::zlib_decompressor());
-    } else if (m_compression_algorithm == "None") {
-      TLOG_DEBUG(TLVL_WORK_STEPS) << "Running without compression" << std::endl;
-    } else {
-      throw BufferedReaderWriterConfigurationError(ERS_HERE,
-                                                   "Non-recognized compression algorithm: " + m_compression_algorithm);
+    if (m_use_mmap) {
+      TLOG() << "Memory mapped reading needs an uncompressed, unstriped file, reading " << m_filename
+             << " through the stream";
     }
+    open_stream(0);
+  }
 
-    m_input_stream.push(io_source, m_buffer_size);
-    m_is_open = true;
+  /**
+   * Position the reader at the last indexed element with a timestamp not after the given one, using the
+   * timestamp index written next to the file (see BufferedFileWriter::set_timestamp_index). Reading the
+   * following elements then reaches the timestamp. Uncompressed and zstd-parallel files are entered at the
+   * indexed position, with the other compression algorithms the data before it is decompressed and skipped.
+   * @return false if the reader is not open, the file has no timestamp index or the index is for another element size.
+   */
+  bool seek(uint64_t timestamp) // NOLINT(build/unsigned)
+  {
+    if (!m_is_open) {
+      return false;
+    }
+    if (!m_timestamp_index_loaded) {
+      if (!m_timestamp_index.read(m_filename + TimestampIndex::s_suffix)) {
+        TLOG_DEBUG(TLVL_WORK_STEPS) << "No timestamp index for " << m_filename << std::endl;
+        return false;
+      }
+      m_timestamp_index_loaded = true;
+    }
+    if (m_timestamp_index.header.element_size != sizeof(ReadoutType)) {
+      TLOG() << "Timestamp index of " << m_filename << " is for elements of " << m_timestamp_index.header.element_size
+             << " bytes, not " << sizeof(ReadoutType);
+      return false;
+    }
+    if (m_mapping != nullptr) {
+      m_mapping_position = std::min<size_t>(m_timestamp_index.offset_before(timestamp), m_mapping_size);
+      return true;
+    }
+    m_input_stream.reset();
+    open_stream(m_timestamp_index.offset_before(timestamp));
+    return true;
   }
 
+  /**
+   * Read uncompressed, unstriped files through a read-only memory mapping, which read_view() returns
+   * elements from without copying. Other files are read through the stream. Takes effect at the next open().
+   */
+  void set_mmap(bool use_mmap) { m_use_mmap = use_mmap; }
+
+  /**
+   * Configure the zstd-parallel and codec modes. Takes effect at the next open().
+   * @param num_threads Number of threads decompressing blocks ahead of the reader.
+   */
+  void set_parallel_decompression(size_t num_threads) { m_num_decompression_threads = std::max<size_t>(num_threads, 1); }
+
+  /**
+   * Register the block codec a file was written with, used when its name is given as compression algorithm.
+   * Takes effect at the next open().
+   */
+  void set_codec(std::shared_ptr<const BlockCodec> codec) { m_codec = std::move(codec); }
+
   /**
    * Check if the file is open.
    * @return true if the file is open, false otherwise.
@@ -128,28 +182,189 @@ public:
   {
     if (!m_is_open)
       return false;
+    if (m_mapping != nullptr) {
+      return read_n(&element, 1) == 1;
+    }
     m_input_stream.read(reinterpret_cast<char*>(&element), sizeof(element)); // NOLINT
     return (m_input_stream.gcount() == sizeof(element));
   }
 
+  /**
+   * Read up to count elements with a single read.
+   * @return The number of complete elements read. Less than count at the end of the file.
+   */
+  size_t read_n(ReadoutType* elements, size_t count)
+  {
+    if (!m_is_open) {
+      return 0;
+    }
+    if (m_mapping != nullptr) {
+      size_t available = 0;
+      const ReadoutType* view = read_view(count, available);
+      std::memcpy(elements, view, available * sizeof(ReadoutType));
+      return available;
+    }
+    m_input_stream.read(reinterpret_cast<char*>(elements), count * sizeof(ReadoutType)); // NOLINT
+    return static_cast<size_t>(m_input_stream.gcount()) / sizeof(ReadoutType);
+  }
+
+  /**
+   * In mmap mode, return up to max_count consecutive elements in place and move past them. The elements
+   * stay valid until the reader is closed or reopened.
+   * @param count Set to the number of elements returned, 0 at the end of the file or if not in mmap mode.
+   */
+  const ReadoutType* read_view(size_t max_count, size_t& count)
+  {
+    count = 0;
+    if (!m_is_open || m_mapping == nullptr) {
+      return nullptr;
+    }
+    const char* position = m_mapping + m_mapping_position;
+    count = std::min(max_count, (m_mapping_size - m_mapping_position) / sizeof(ReadoutType));
+    m_mapping_position += count * sizeof(ReadoutType);
+    // Keep the kernel reading ahead of the consumer
+    if (m_mapping_position + s_readahead_bytes / 2 > m_advised_until && m_advised_until < m_mapping_size) {
+      auto from = m_advised_until / s_page_size * s_page_size;
+      m_advised_until = std::min(m_mapping_size, m_mapping_position + s_readahead_bytes);
+      ::madvise(const_cast<char*>(m_mapping) + from, m_advised_until - from, MADV_WILLNEED); // NOLINT
+    }
+    return reinterpret_cast<const ReadoutType*>(position); // NOLINT
+  }
+
   /**
    * Close the reader.
    */
   void close()
   {
     m_input_stream.reset();
+    unmap();
     m_is_open = false;
   }
 
 private:
+  static constexpr size_t s_readahead_bytes = 64 * 1024 * 1024;
+  static constexpr size_t s_page_size = 4096;
+
+  void open_mapping()
+  {
+    unmap();
+    int fd = ::open(m_filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+      throw BufferedReaderWriterCannotOpenFile(ERS_HERE, m_filename);
+    }
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0) {
+      ::close(fd);
+      throw BufferedReaderWriterCannotOpenFile(ERS_HERE, m_filename);
+    }
+    m_mapping_size = file_stat.st_size;
+    if (m_mapping_size > 0) {
+      void* mapping = ::mmap(nullptr, m_mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (mapping == MAP_FAILED) {
+        ::close(fd);
+        throw BufferedReaderWriterCannotOpenFile(ERS_HERE, m_filename);
+      }
+      m_mapping = static_cast<const char*>(mapping);
+      ::madvise(mapping, m_mapping_size, MADV_SEQUENTIAL);
+    } else {
+      // Nothing to map, an empty mapping reads as the end of the file
+      static const char s_empty = 0;
+      m_mapping = &s_empty;
+    }
+    // The mapping stays valid without the descriptor
+    ::close(fd);
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "Memory mapped " << m_mapping_size << " bytes of " << m_filename << std::endl;
+    m_mapping_position = 0;
+    m_advised_until = 0;
+    m_is_open = true;
+  }
+
+  void unmap()
+  {
+    if (m_mapping != nullptr && m_mapping_size > 0) {
+      ::munmap(const_cast<char*>(m_mapping), m_mapping_size); // NOLINT
+    }
+    m_mapping = nullptr;
+    m_mapping_size = 0;
+  }
+
+  // Set up the input stream to start at the given offset of the uncompressed data
+  void open_stream(uint64_t start_offset) // NOLINT(build/unsigned)
+  {
+    bool codec = m_codec && m_compression_algorithm == m_codec->name();
+    if (m_compression_algorithm == "zstd-parallel" || codec) {
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Using parallel " << m_compression_algorithm << " decompression with "
+                                  << m_num_decompression_threads << " threads" << std::endl;
+      ParallelBlockSource block_source(
+        m_filename, m_num_decompression_threads, start_offset, codec ? m_codec : nullptr);
+      m_input_stream.push(block_source, m_buffer_size);
+      m_is_open = true;
+      return;
+    }
+
+    // Without compression the device starts at the offset, otherwise the decompressed data before it is skipped
+    uint64_t device_offset = m_compression_algorithm == "None" ? start_offset : 0; // NOLINT(build/unsigned)
+    if (StripeManifest::is_manifest(m_filename)) {
+      StripedFileSource striped_source(StripeManifest::read(m_filename), device_offset);
+      push_decompressor();
+      m_input_stream.push(striped_source, m_buffer_size);
+    } else {
+      int fd = ::open(m_filename.c_str(), O_RDONLY);
+      if (fd == -1) {
+        throw BufferedReaderWriterCannotOpenFile(ERS_HERE, m_filename);
+      }
+      if (device_offset > 0) {
+        ::lseek(fd, device_offset, SEEK_SET);
+      }
+
+      io_source_t io_source(fd, boost::iostreams::file_descriptor_flags::close_handle);
+      push_decompressor();
+      m_input_stream.push(io_source, m_buffer_size);
+    }
+    if (start_offset > device_offset) {
+      m_input_stream.ignore(start_offset - device_offset);
+    }
+    m_is_open = true;
+  }
+
+  void push_decompressor()
+  {
+    if (m_compression_algorithm == "zstd") {
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Using zstd compression" << std::endl;
+      m_input_stream.push(boost::iostreams::zstd_decompressor());
+    } else if (m_compression_algorithm == "lzma") {
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Using lzma compression" << std::endl;
+      m_input_stream.push(boost::iostreams::lzma_decompressor());
+    } else if (m_compression_algorithm == "zlib") {
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Using zlib compression" << std::endl;
+      m_input_stream.push(boost::iostreams::zlib_decompressor());
+    } else if (m_compression_algorithm == "None") {
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Running without compression" << std::endl;
+    } else {
+      throw BufferedReaderWriterConfigurationError(ERS_HERE,
+                                                   "Non-recognized compression algorithm: " + m_compression_algorithm);
+    }
+  }
+
   // Config parameters
   std::string m_filename;
   size_t m_buffer_size;
   std::string m_compression_algorithm;
+  size_t m_num_decompression_threads = 4;
+  std::shared_ptr<const BlockCodec> m_codec;
 
   // Internals
   filtering_istream_t m_input_stream;
+  TimestampIndex m_timestamp_index;
+  bool m_timestamp_index_loaded = false;
   bool m_is_open = false;
+
+  // mmap mode
+  bool m_use_mmap = false;
+  const char* m_mapping = nullptr;
+  size_t m_mapping_size = 0;
+  size_t m_mapping_position = 0;
+  size_t m_advised_until = 0; // End of the range last advised to be read ahead
 };
 
 } // namespace datahandlinglibs
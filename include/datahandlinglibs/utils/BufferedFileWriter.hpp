@@ -13,10 +13,15 @@
 
 #include "datahandlinglibs/DataHandlingIssues.hpp"
 #include "datahandlinglibs/ReadoutLogging.hpp"
+#include "datahandlinglibs/utils/DoubleBufferedFileWriter.hpp"
+#include "datahandlinglibs/utils/ParallelBlockCompression.hpp"
+#include "datahandlinglibs/utils/TimestampIndex.hpp"
 
 #include "logging/Logging.hpp"
 
 #include <boost/align/aligned_allocator.hpp>
+#include <boost/asio.hpp>
+#include <boost/iostreams/categories.hpp>
 #include <boost/iostreams/device/file_descriptor.hpp>
 #include <boost/iostreams/filter/lzma.hpp>
 #include <boost/iostreams/filter/zlib.hpp>
@@ -25,12 +30,19 @@
 #include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/stream_buffer.hpp>
 
+#include <chrono>
+#include <cstdio>
+#include <deque>
 #include <fcntl.h>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <string>
 #include <unistd.h>
+#include <utility>
+#include <vector>
 
 using dunedaq::datahandlinglibs::logging::TLVL_WORK_STEPS;
 
@@ -58,7 +70,9 @@ public:
    * created.
    * @param buffer_size The size of the buffer that is used before data is written to the file. Make sure that this
    * size fulfils size requirements of O_DIRECT, otherwise writes will fail.
-   * @param compression_algorithm The compression algorithm to use. Can be one of: None, zstd, lzma or zlib
+   * @param compression_algorithm The compression algorithm to use. Can be one of: None, zstd, zstd-parallel, lzma,
+   * zlib or the name of a codec registered with set_codec(). zstd-parallel and codecs encode independent blocks on a
+   * pool of threads, see set_parallel_compression().
    * @param use_o_direct file descriptors : avoid excessive resource footprint. It also avoids the intermediate aligned buffer, requires the source latency buffer to be memory aligned.
    * @throw CannotOpenFile If the file can not be opened.
    * @throw ConfigurationError If the compression algorithm parameter is not recognized.
@@ -93,7 +107,9 @@ public:
    * created.
    * @param buffer_size The size of the buffer that is used before data is written to the file. Make sure that this
    * size fulfils size requirements of O_DIRECT, otherwise writes will fail.
-   * @param compression_algorithm The compression algorithm to use. Can be one of: None, zstd, lzma or zlib
+   * @param compression_algorithm The compression algorithm to use. Can be one of: None, zstd, zstd-parallel, lzma,
+   * zlib or the name of a codec registered with set_codec(). zstd-parallel and codecs encode independent blocks on a
+   * pool of threads, see set_parallel_compression().
    * @param use_o_direct file descriptors : avoid excessive resource footprint. It also avoids the intermediate aligned buffer, requires the source latency buffer to be memory aligned.
    * @throw CannotOpenFile If the file can not be opened.
    * @throw ConfigurationError If the compression algorithm parameter is not recognized.
@@ -116,13 +132,35 @@ public:
       oflag = oflag | O_DIRECT;
     }
 
-    m_fd = ::open(m_filename.c_str(), oflag, 0644);
-    if (m_fd == -1) {
-      throw BufferedReaderWriterCannotOpenFile(ERS_HERE, m_filename);
+    m_staged = m_num_staging_buffers >= 2;
+    if (m_staged) {
+      // The staging writer owns the file and keeps O_DIRECT on it throughout
+      m_staged_writer.open(m_filename, m_buffer_size, m_use_o_direct, m_num_staging_buffers);
+    } else {
+      m_fd = ::open(m_filename.c_str(), oflag, 0644);
+      if (m_fd == -1) {
+        throw BufferedReaderWriterCannotOpenFile(ERS_HERE, m_filename);
+      }
+      m_sink = io_sink_t(m_fd, boost::iostreams::file_descriptor_flags::close_handle);
     }
+    // Index files of an earlier file with the same name would no longer match the data
+    std::remove((m_filename + s_block_index_suffix).c_str());
+    std::remove((m_filename + TimestampIndex::s_suffix).c_str());
 
-    m_sink = io_sink_t(m_fd, boost::iostreams::file_descriptor_flags::close_handle);
-    if (m_compression_algorithm == "zstd") {
+    if (m_compression_algorithm == "zstd-parallel" || (m_codec && m_compression_algorithm == m_codec->name())) {
+      // Blocks are encoded on the pool and reach the stream already compressed
+      m_block_codec = m_compression_algorithm == "zstd-parallel" ? std::make_shared<ZstdBlockCodec>() : m_codec;
+      auto alignment = std::max<size_t>(m_block_codec->block_alignment(), 1);
+      m_block_size = std::max(alignment, m_compression_block_size / alignment * alignment);
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Using parallel " << m_compression_algorithm << " compression with "
+                                  << m_num_compression_threads << " threads and " << m_block_size << " byte blocks"
+                                  << std::endl;
+      m_compression_pool = std::make_unique<boost::asio::thread_pool>(m_num_compression_threads);
+      m_block.reserve(m_block_size);
+      m_block_index.clear();
+      m_compressed_offset = 0;
+      m_compression_failed = false;
+    } else if (m_compression_algorithm == "zstd") {
       TLOG_DEBUG(TLVL_WORK_STEPS) << "Using zstd compression" << std::endl;
       m_output_stream.push(boost::iostreams::zstd_compressor(boost::iostreams::zstd::best_speed));
     } else if (m_compression_algorithm == "lzma") {
@@ -138,10 +176,57 @@ public:
                                                    "Non-recognized compression algorithm: " + m_compression_algorithm);
     }
 
-    m_output_stream.push(m_sink, m_buffer_size);
+    if (!m_staged) {
+      m_output_stream.push(m_sink, m_buffer_size);
+    } else if (m_compression_algorithm != "None") {
+      // Without compression, writes go straight to the staging buffers
+      m_output_stream.push(StagedSink{ &m_staged_writer }, m_buffer_size);
+    }
+    m_bytes_written = 0;
+    m_timestamp_index.entries.clear();
     m_is_open = true;
   }
 
+  /**
+   * Configure the zstd-parallel and codec compression modes. Takes effect at the next open().
+   * @param num_threads Number of threads compressing blocks.
+   * @param block_size Size of the uncompressed blocks. Each is compressed independently, e.g. into a zstd frame.
+   */
+  void set_parallel_compression(size_t num_threads, size_t block_size)
+  {
+    m_num_compression_threads = std::max<size_t>(num_threads, 1);
+    m_compression_block_size = std::max<size_t>(block_size, 1);
+  }
+
+  /**
+   * Write through aligned staging buffers of buffer_size bytes. While one buffer is filled on the calling
+   * thread, the others are written with O_DIRECT by a background thread. Unaligned tails at flush() and
+   * close() are written padded and the file is truncated, instead of turning O_DIRECT off. Unlike the
+   * direct mode, an existing file is truncated at open(). Takes effect at the next open().
+   * @param num_buffers Number of staging buffers. Below 2 (the default 0) the data is written on the calling thread.
+   */
+  void set_staging_buffers(size_t num_buffers) { m_num_staging_buffers = num_buffers; }
+
+  /**
+   * Register a block codec, used when its name is given as compression algorithm. Takes effect at the next open().
+   * The blocks are cut at multiples of the codec's block alignment.
+   */
+  void set_codec(std::shared_ptr<const BlockCodec> codec) { m_codec = std::move(codec); }
+
+  /**
+   * Keep a timestamp index of the file in <filename>.tsidx, filled by the write() overload taking a timestamp.
+   * Takes effect at the next open().
+   * @param element_size Size of the recorded elements, stored in the index header.
+   * @param element_type Type tag of the recorded elements, e.g. the fragment type. 0 if unspecified.
+   * @param interval_bytes Minimum distance between index entries. 0 disables the index.
+   */
+  void set_timestamp_index(uint32_t element_size, uint32_t element_type, size_t interval_bytes) // NOLINT(build/unsigned)
+  {
+    m_timestamp_index.header.element_size = element_size;
+    m_timestamp_index.header.element_type = element_type;
+    m_timestamp_index_interval = interval_bytes;
+  }
+
   /**
    * Check if the file is open.
    * @return true if the file is open, false otherwise.
@@ -157,10 +242,31 @@ public:
   {
     if (!m_is_open)
       return false;
+    m_bytes_written += size;
+    if (m_compression_pool) {
+      return write_blocks(memory, size);
+    }
+    if (m_staged && m_compression_algorithm == "None") {
+      return m_staged_writer.append(memory, size);
+    }
     m_output_stream.write(memory, size); // NOLINT
     return !m_output_stream.bad();
   }
 
+  /**
+   * Write an element starting at the given timestamp, adding it to the timestamp index if the last
+   * index entry is at least the configured interval behind.
+   */
+  bool write(const char* memory, const size_t size, uint64_t timestamp) // NOLINT(build/unsigned)
+  {
+    if (m_is_open && m_timestamp_index_interval > 0 &&
+        (m_timestamp_index.entries.empty() ||
+         m_bytes_written - m_timestamp_index.entries.back().offset >= m_timestamp_index_interval)) {
+      m_timestamp_index.entries.push_back({ timestamp, m_bytes_written });
+    }
+    return write(memory, size);
+  }
+
   /**
    * Close the writer. All data from any buffers will be written to file.
    */
@@ -168,22 +274,55 @@ public:
   {
     // Set the file descriptor to not use O_DIRECT. This is necessary because the write size has to be aligned for
     // O_DIRECT to succeed. This is not guaranteed for the data that remains in the buffer.
-    fcntl(m_fd, F_SETFL, O_CREAT | O_WRONLY);
+    if (!m_staged) {
+      fcntl(m_fd, F_SETFL, O_CREAT | O_WRONLY);
+    }
+    if (m_compression_pool) {
+      submit_block();
+      write_compressed_blocks(true);
+      m_compression_pool->join();
+      m_compression_pool.reset();
+      if (!write_block_index(m_filename + s_block_index_suffix, m_block_index)) {
+        ers::error(BufferedReaderWriterCannotOpenFile(ERS_HERE, m_filename + s_block_index_suffix));
+      }
+    }
+    write_timestamp_index();
     m_output_stream.reset();
+    if (m_staged) {
+      m_staged_writer.close();
+    }
     m_is_open = false;
   }
 
   /**
-   * If no compression is used, this writes all data from buffers to the file. In case that compression is used,
-   * this is not guaranteed.
+   * If no compression, zstd-parallel or a codec is used, this writes all data from buffers to the file. With the other
+   * compression algorithms this is not guaranteed.
    */
   void flush()
   {
+    if (m_staged) {
+      if (m_compression_pool) {
+        submit_block();
+        write_compressed_blocks(true);
+      }
+      if (m_output_stream.is_complete()) {
+        m_output_stream.flush();
+      }
+      m_staged_writer.flush();
+      write_timestamp_index();
+      return;
+    }
     // Set the file descriptor to not use O_DIRECT. This is necessary because the write size has to be aligned for
     // O_DIRECT to succeed. This is not guaranteed for the data that remains in the buffer.
     fcntl(m_fd, F_SETFL, O_CREAT | O_WRONLY);
+    if (m_compression_pool) {
+      // The partial block is ended early, so everything written so far can be read back
+      submit_block();
+      write_compressed_blocks(true);
+    }
     // This does not flush the compressor as it is not flushable
     m_output_stream.flush();
+    write_timestamp_index();
     // Activate O_DIRECT again
     auto oflag = O_CREAT | O_WRONLY;
     if (m_use_o_direct) {
@@ -193,17 +332,112 @@ public:
   }
 
 private:
+  // Device handing the stream output to the staging writer
+  struct StagedSink
+  {
+    using char_type = char;
+    using category = boost::iostreams::sink_tag;
+
+    std::streamsize write(const char* s, std::streamsize n) { return writer->append(s, n) ? n : -1; }
+
+    DoubleBufferedFileWriter* writer;
+  };
+
+  void write_timestamp_index()
+  {
+    if (m_timestamp_index_interval > 0 && !m_timestamp_index.write(m_filename + TimestampIndex::s_suffix)) {
+      ers::error(BufferedReaderWriterCannotOpenFile(ERS_HERE, m_filename + TimestampIndex::s_suffix));
+    }
+  }
+
+  // Append to the current block, handing full blocks to the compression pool
+  bool write_blocks(const char* memory, size_t size)
+  {
+    while (size > 0) {
+      auto bytes = std::min(size, m_block_size - m_block.size());
+      m_block.insert(m_block.end(), memory, memory + bytes);
+      memory += bytes;
+      size -= bytes;
+      if (m_block.size() == m_block_size) {
+        submit_block();
+      }
+    }
+    write_compressed_blocks(false);
+    return !m_compression_failed && !m_output_stream.bad();
+  }
+
+  void submit_block()
+  {
+    if (m_block.empty()) {
+      return;
+    }
+    auto block = std::make_shared<std::vector<char>>(std::move(m_block));
+    auto codec = m_block_codec;
+    auto task = std::make_shared<std::packaged_task<std::vector<char>()>>(
+      [block, codec]() { return codec->encode(block->data(), block->size()); });
+    m_pending_blocks.emplace_back(block->size(), task->get_future());
+    boost::asio::post(*m_compression_pool, [task]() { (*task)(); });
+    m_block = std::vector<char>();
+    m_block.reserve(m_block_size);
+  }
+
+  // Write the compressed blocks that are ready, in order. With wait_all, wait for all of them.
+  void write_compressed_blocks(bool wait_all)
+  {
+    while (!m_pending_blocks.empty()) {
+      auto& pending = m_pending_blocks.front();
+      // Keep the number of blocks held in memory bounded
+      bool must_wait = wait_all || m_pending_blocks.size() > 2 * m_num_compression_threads;
+      if (!must_wait && pending.second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        break;
+      }
+      try {
+        auto compressed = pending.second.get();
+        m_output_stream.write(compressed.data(), compressed.size()); // NOLINT
+        m_block_index.push_back({ m_compressed_offset, compressed.size(), pending.first });
+        m_compressed_offset += compressed.size();
+      } catch (const std::exception& e) {
+        TLOG() << "Block compression failed: " << e.what();
+        m_compression_failed = true;
+      }
+      m_pending_blocks.pop_front();
+    }
+  }
+
   // Config parameters
   std::string m_filename;
   size_t m_buffer_size;
   std::string m_compression_algorithm;
 
   // Internals
-  int m_fd;
+  int m_fd = -1;
   io_sink_t m_sink;
   filtering_ostream_t m_output_stream;
   bool m_is_open = false;
   bool m_use_o_direct = true;
+
+  // Staging mode
+  size_t m_num_staging_buffers = 0;
+  bool m_staged = false;
+  DoubleBufferedFileWriter m_staged_writer;
+
+  // Timestamp index
+  uint64_t m_bytes_written = 0; // Uncompressed // NOLINT(build/unsigned)
+  size_t m_timestamp_index_interval = 0;
+  TimestampIndex m_timestamp_index;
+
+  // zstd-parallel and codec modes
+  size_t m_num_compression_threads = 4;
+  size_t m_compression_block_size = 4 * 1024 * 1024;
+  std::shared_ptr<const BlockCodec> m_codec;
+  std::shared_ptr<const BlockCodec> m_block_codec;
+  size_t m_block_size = 0; // Block size rounded to the codec alignment
+  std::unique_ptr<boost::asio::thread_pool> m_compression_pool;
+  std::vector<char> m_block;
+  std::deque<std::pair<size_t, std::future<std::vector<char>>>> m_pending_blocks; // Uncompressed size, result
+  std::vector<CompressedBlockIndexEntry> m_block_index;
+  uint64_t m_compressed_offset = 0; // NOLINT(build/unsigned)
+  bool m_compression_failed = false;
 };
 
 } // namespace datahandlinglibs
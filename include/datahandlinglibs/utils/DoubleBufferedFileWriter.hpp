@@ -0,0 +1,309 @@
+/**
+ * @file DoubleBufferedFileWriter.hpp File writer collecting appended data in
+ * two or more aligned staging buffers. While one buffer fills, the others
+ * are written in order by a background thread, one (optionally O_DIRECT)
+ * write per buffer, so the appending thread only waits when the disk falls
+ * all the other buffers behind.
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_DOUBLEBUFFEREDFILEWRITER_HPP_
+#define DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_DOUBLEBUFFEREDFILEWRITER_HPP_
+
+#include "datahandlinglibs/DataHandlingIssues.hpp"
+#include "datahandlinglibs/ReadoutLogging.hpp"
+#include "datahandlinglibs/utils/TimestampIndex.hpp"
+#include "datahandlinglibs/utils/UringFileWriter.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <boost/align/aligned_allocator.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using dunedaq::datahandlinglibs::logging::TLVL_WORK_STEPS;
+
+namespace dunedaq {
+namespace datahandlinglibs {
+
+/** DoubleBufferedFileWriter usage:
+ *
+ *   DoubleBufferedFileWriter writer;
+ *   writer.open("out.bin", 1024 * 1024, true); // batches of 1MiB, written with O_DIRECT
+ *   char* slot = writer.reserve(size);          // room for size bytes in the filling buffer
+ *   ... fill slot ...
+ *   writer.commit(size, timestamp);             // hands the buffer to the writer thread once full
+ *   writer.append(data, size);                  // same as reserve, memcpy and commit, in pieces
+ *   writer.hand_off();                          // e.g. when the input is idle
+ *   writer.flush();                             // everything appended so far is in the file
+ *   writer.close();                             // writes the rest and closes the file
+ *
+ * With O_DIRECT only whole multiples of the alignment are written per batch; the remainder is
+ * carried over to the start of the next buffer. flush() writes the remainder padded to the
+ * alignment and truncates the file to its real length, so the file keeps O_DIRECT throughout.
+ * The padded unit is written again, completed, by the next batch.
+ */
+class DoubleBufferedFileWriter
+{
+public:
+  static constexpr std::size_t s_alignment = 4096;
+
+  DoubleBufferedFileWriter() {}
+
+  ~DoubleBufferedFileWriter() { close(); }
+
+  DoubleBufferedFileWriter(const DoubleBufferedFileWriter&) = delete;            ///< Not copy-constructible
+  DoubleBufferedFileWriter& operator=(const DoubleBufferedFileWriter&) = delete; ///< Not copy-assginable
+  DoubleBufferedFileWriter(DoubleBufferedFileWriter&&) = delete;                 ///< Not move-constructible
+  DoubleBufferedFileWriter& operator=(DoubleBufferedFileWriter&&) = delete;      ///< Not move-assignable
+
+  /**
+   * Open a file and start the writer thread.
+   * @param batch_size Bytes collected in a buffer before it is written.
+   * @param use_o_direct Whether to write the batches with O_DIRECT.
+   * @param num_buffers Number of staging buffers, at least 2.
+   * @throw BufferedReaderWriterCannotOpenFile If the file can not be opened.
+   */
+  void open(const std::string& filename, std::size_t batch_size, bool use_o_direct, std::size_t num_buffers = 2)
+  {
+    close();
+    int flags = O_CREAT | O_WRONLY | O_TRUNC;
+    if (use_o_direct) {
+      flags |= O_DIRECT;
+    }
+    m_fd = ::open(filename.c_str(), flags, 0644);
+    if (m_fd == -1) {
+      throw BufferedReaderWriterCannotOpenFile(ERS_HERE, filename);
+    }
+    m_filename = filename;
+    m_unit = use_o_direct ? s_alignment : 1;
+    m_batch_size = std::max(batch_size, m_unit);
+    // A buffer is handed off once it holds a batch, so the last reserve() can go up to twice the batch size
+    auto capacity = (2 * m_batch_size + s_alignment - 1) / s_alignment * s_alignment;
+    m_buffers.resize(std::max<std::size_t>(num_buffers, 2));
+    for (auto& buffer : m_buffers) {
+      buffer.memory.assign(capacity, 0);
+      buffer.bytes = 0;
+      buffer.busy = false;
+    }
+    m_filling = 0;
+    m_queue.clear();
+    m_stop = false;
+    m_bytes_appended = 0;
+    m_failed_writes = 0;
+    m_timestamp_index.entries.clear();
+    m_file.open(m_fd, 0);
+    m_writer = std::thread(&DoubleBufferedFileWriter::write_batches, this);
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "Staged writer on " << filename << " with " << m_buffers.size()
+                                << " buffers of " << m_batch_size << " bytes, O_DIRECT " << use_o_direct;
+  }
+
+  bool is_open() const { return m_fd != -1; }
+
+  /**
+   * Record an entry in a timestamp index written next to the file at close(), see
+   * BufferedFileWriter::set_timestamp_index. Takes effect at the next open().
+   */
+  void set_timestamp_index(uint32_t element_size, uint32_t element_type, std::size_t interval_bytes) // NOLINT(build/unsigned)
+  {
+    m_timestamp_index.header.element_size = element_size;
+    m_timestamp_index.header.element_type = element_type;
+    m_timestamp_index_interval = interval_bytes;
+  }
+
+  /**
+   * Room for size bytes in the filling buffer, valid until the next commit(). size must not exceed the batch size.
+   */
+  char* reserve(std::size_t size)
+  {
+    auto& buffer = m_buffers[m_filling];
+    if (buffer.bytes + size > buffer.memory.size()) {
+      hand_off();
+    }
+    return m_buffers[m_filling].memory.data() + m_buffers[m_filling].bytes;
+  }
+
+  // Account for size bytes filled in at the last reserve(), starting an element at the given timestamp
+  void commit(std::size_t size, uint64_t timestamp) // NOLINT(build/unsigned)
+  {
+    if (m_timestamp_index_interval > 0 &&
+        (m_timestamp_index.entries.empty() ||
+         m_bytes_appended - m_timestamp_index.entries.back().offset >= m_timestamp_index_interval)) {
+      m_timestamp_index.entries.push_back({ timestamp, m_bytes_appended });
+    }
+    commit(size);
+  }
+
+  // Account for size bytes filled in at the last reserve(). Hands the buffer off once a batch is complete.
+  void commit(std::size_t size)
+  {
+    m_bytes_appended += size;
+    m_buffers[m_filling].bytes += size;
+    if (m_buffers[m_filling].bytes >= m_batch_size) {
+      hand_off();
+    }
+  }
+
+  // Copy data of any size into the staging buffers
+  bool append(const char* data, std::size_t size)
+  {
+    while (size > 0) {
+      auto piece = std::min(size, m_batch_size);
+      std::memcpy(reserve(piece), data, piece);
+      commit(piece);
+      data += piece;
+      size -= piece;
+    }
+    return m_failed_writes == 0;
+  }
+
+  /**
+   * Queue the writable part of the filling buffer and continue in the next buffer, waiting only
+   * if that one is still being written. Nothing happens if less than one alignment unit is filled.
+   */
+  void hand_off()
+  {
+    auto& buffer = m_buffers[m_filling];
+    auto writable = buffer.bytes / m_unit * m_unit;
+    if (writable == 0) {
+      return;
+    }
+    auto next = (m_filling + 1) % m_buffers.size();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [&]() { return !m_buffers[next].busy; });
+    buffer.busy = true;
+    m_queue.emplace_back(m_filling, writable);
+    lock.unlock();
+    m_cv.notify_all();
+    // The writer thread only reads the written part, the remainder is copied concurrently
+    auto remainder = buffer.bytes - writable;
+    std::memcpy(m_buffers[next].memory.data(), buffer.memory.data() + writable, remainder);
+    m_buffers[next].bytes = remainder;
+    m_filling = next;
+  }
+
+  /**
+   * Wait until everything appended so far is in the file. An unaligned remainder is written padded
+   * with zeros and the file is truncated to the appended length.
+   * @return false if a write failed.
+   */
+  bool flush()
+  {
+    if (m_fd == -1) {
+      return false;
+    }
+    hand_off();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [&]() {
+      return std::none_of(m_buffers.begin(), m_buffers.end(), [](const Buffer& buffer) { return buffer.busy; });
+    });
+    lock.unlock();
+    auto& tail = m_buffers[m_filling];
+    if (tail.bytes > 0) {
+      // The file offset is not advanced, the next batch starts with the same tail and rewrites the unit
+      auto padded = (tail.bytes + m_unit - 1) / m_unit * m_unit;
+      std::memset(tail.memory.data() + tail.bytes, 0, padded - tail.bytes);
+      if (!UringFileWriter::pwrite_fully(m_fd, tail.memory.data(), padded, m_file.file_offset()) ||
+          ::ftruncate(m_fd, m_file.file_offset() + tail.bytes) != 0) {
+        ++m_failed_writes;
+      }
+    }
+    return m_failed_writes == 0;
+  }
+
+  std::size_t failed_writes() const { return m_failed_writes; }
+
+  // Write everything appended so far, stop the writer thread and close the file.
+  void close()
+  {
+    if (m_fd == -1) {
+      return;
+    }
+    flush();
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cv.notify_all();
+    m_writer.join();
+    m_buffers[m_filling].bytes = 0;
+    m_file.close();
+    ::close(m_fd);
+    m_fd = -1;
+    if (m_failed_writes > 0) {
+      ers::warning(CannotWriteToFile(ERS_HERE, m_filename));
+    }
+    if (m_timestamp_index_interval > 0 && !m_timestamp_index.write(m_filename + TimestampIndex::s_suffix)) {
+      ers::error(BufferedReaderWriterCannotOpenFile(ERS_HERE, m_filename + TimestampIndex::s_suffix));
+    }
+  }
+
+private:
+  struct Buffer
+  {
+    std::vector<char, boost::alignment::aligned_allocator<char, s_alignment>> memory;
+    std::size_t bytes = 0;
+    bool busy = false; // Queued or being written, guarded by m_mutex
+  };
+
+  void write_batches()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+      m_cv.wait(lock, [&]() { return !m_queue.empty() || m_stop; });
+      if (m_queue.empty()) {
+        return;
+      }
+      auto [index, bytes] = m_queue.front();
+      m_queue.pop_front();
+      lock.unlock();
+      if (!m_file.write(m_buffers[index].memory.data(), bytes)) {
+        ++m_failed_writes;
+      }
+      lock.lock();
+      m_buffers[index].busy = false;
+      m_cv.notify_all();
+    }
+  }
+
+  std::string m_filename;
+  int m_fd = -1;
+  std::size_t m_unit = 1;
+  std::size_t m_batch_size = 0;
+  std::vector<Buffer> m_buffers;
+  std::size_t m_filling = 0;
+  UringFileWriter m_file;
+
+  // Handed between the appending and the writer thread under m_mutex
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<std::pair<std::size_t, std::size_t>> m_queue; // Buffer, bytes to write
+  bool m_stop = false;
+  std::thread m_writer;
+
+  uint64_t m_bytes_appended = 0; // NOLINT(build/unsigned)
+  std::atomic<std::size_t> m_failed_writes{ 0 };
+  std::size_t m_timestamp_index_interval = 0;
+  TimestampIndex m_timestamp_index;
+};
+
+} // namespace datahandlinglibs
+} // namespace dunedaq
+
+#endif // DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_DOUBLEBUFFEREDFILEWRITER_HPP_
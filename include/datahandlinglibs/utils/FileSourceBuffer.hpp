@@ -1,5 +1,6 @@
 /**
- * @file FileSourceBuffer.hpp Reads in data from raw binary dump files
+ * @file FileSourceBuffer.hpp Reads in data from raw binary dump files, mapped
+ * into memory and shared between the buffers reading the same file
  *
  * This is part of the DUNE DAQ , copyright 2020.
  * Licensing/copyright details are in the COPYING file that you should have
@@ -13,24 +14,102 @@
 
 #include "logging/Logging.hpp"
 
-#include <fstream>
-#include <limits>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <sstream>
 #include <string>
-#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using dunedaq::datahandlinglibs::logging::TLVL_BOOKKEEPING;
 
 namespace dunedaq {
 namespace datahandlinglibs {
 
+/**
+ * Read-only private mapping of a whole file, populated at construction.
+ */
+class MappedFile
+{
+public:
+  /**
+   * @param huge_pages Ask for the mapping to be backed by transparent huge pages. Only honoured where
+   * the kernel supports them for file mappings.
+   * @throw CannotOpenFile If the file can not be opened or mapped.
+   */
+  MappedFile(const std::string& filename, bool huge_pages)
+  {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+      throw CannotOpenFile(ERS_HERE, filename);
+    }
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0) {
+      ::close(fd);
+      throw CannotOpenFile(ERS_HERE, filename);
+    }
+    m_size = file_stat.st_size;
+    m_modification_time = file_stat.st_mtime;
+    if (m_size > 0) {
+      void* mapping = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+      if (mapping == MAP_FAILED) {
+        ::close(fd);
+        throw CannotOpenFile(ERS_HERE, filename);
+      }
+      m_data = static_cast<const uint8_t*>(mapping); // NOLINT(build/unsigned)
+      if (huge_pages) {
+        ::madvise(mapping, m_size, MADV_HUGEPAGE);
+      }
+    }
+    // The mapping stays valid without the descriptor
+    ::close(fd);
+  }
+
+  ~MappedFile()
+  {
+    if (m_data != nullptr) {
+      ::munmap(const_cast<uint8_t*>(m_data), m_size); // NOLINT
+    }
+  }
+
+  MappedFile(const MappedFile&) = delete;            ///< MappedFile is not copy-constructible
+  MappedFile& operator=(const MappedFile&) = delete; ///< MappedFile is not copy-assginable
+  MappedFile(MappedFile&&) = delete;                 ///< MappedFile is not move-constructible
+  MappedFile& operator=(MappedFile&&) = delete;      ///< MappedFile is not move-assignable
+
+  const uint8_t* data() const { return m_data; } // NOLINT(build/unsigned)
+  std::size_t size() const { return m_size; }
+
+  // Whether the file on disk still has the size and modification time it was mapped with
+  bool matches(const struct stat& file_stat) const
+  {
+    return static_cast<std::size_t>(file_stat.st_size) == m_size && file_stat.st_mtime == m_modification_time;
+  }
+
+private:
+  const uint8_t* m_data = nullptr; // NOLINT(build/unsigned)
+  std::size_t m_size = 0;
+  time_t m_modification_time = 0;
+};
+
 class FileSourceBuffer
 {
 public:
-  explicit FileSourceBuffer(int input_limit, int chunk_size = 0)
+  /**
+   * @param use_huge_pages Ask for the file mapping to be backed by huge pages, see MappedFile.
+   */
+  explicit FileSourceBuffer(int input_limit, int chunk_size = 0, bool use_huge_pages = false)
     : m_input_limit(input_limit)
     , m_chunk_size(chunk_size)
     , m_element_count(0)
     , m_source_filename("")
+    , m_use_huge_pages(use_huge_pages)
   {}
 
   FileSourceBuffer(const FileSourceBuffer&) = delete;            ///< FileSourceBuffer is not copy-constructible
@@ -38,20 +117,18 @@ public:
   FileSourceBuffer(FileSourceBuffer&&) = delete;                 ///< FileSourceBuffer is not move-constructible
   FileSourceBuffer& operator=(FileSourceBuffer&&) = delete;      ///< FileSourceBuffer is not move-assignable
 
+  /**
+   * Map the file. Buffers reading the same path share one mapping, which is released with the last of them.
+   */
   void read(const std::string& sourcefile)
   {
     m_source_filename = sourcefile;
     try {
 
-      // Open file
-      m_rawdata_ifs.open(m_source_filename, std::ios::in | std::ios::binary);
-      if (!m_rawdata_ifs) {
-        throw CannotOpenFile(ERS_HERE, m_source_filename);
-      }
+      m_mapping = acquire_mapping(m_source_filename, m_use_huge_pages);
 
       // Check file size
-      m_rawdata_ifs.ignore(std::numeric_limits<std::streamsize>::max());
-      std::streamsize filesize = m_rawdata_ifs.gcount();
+      auto filesize = static_cast<std::streamsize>(m_mapping->size());
       if (filesize > m_input_limit) { // bigger than configured limit
         std::ostringstream oss;
         oss << "File size limit exceeded, "
@@ -77,12 +154,7 @@ public:
         TLOG_DEBUG(TLVL_BOOKKEEPING) << "Available elements: " << std::to_string(m_element_count);
       }
 
-      // Read file into input buffer
-      m_rawdata_ifs.seekg(0, std::ios::beg);
-      m_input_buffer.reserve(filesize);
-      m_input_buffer.insert(
-        m_input_buffer.begin(), std::istreambuf_iterator<char>(m_rawdata_ifs), std::istreambuf_iterator<char>());
-      TLOG_DEBUG(TLVL_BOOKKEEPING) << "Available bytes " << std::to_string(m_input_buffer.size());
+      TLOG_DEBUG(TLVL_BOOKKEEPING) << "Available bytes " << std::to_string(m_mapping->size());
 
     } catch (const std::exception& ex) {
       throw GenericConfigurationError(ERS_HERE, "Cannot read file: " + m_source_filename, ex.what());
@@ -91,10 +163,15 @@ public:
 
   const int& num_elements() { return std::ref(m_element_count); }
 
-  std::vector<std::uint8_t>& get() // NOLINT(build/unsigned)
-  {
-    return std::ref(m_input_buffer);
-  }
+  // Read-only view of the file. Only valid after read().
+  const MappedFile& get() const { return *m_mapping; }
+
+  /**
+   * Process-wide cache of file mappings keyed by path. A cached mapping is reused as long as the file
+   * keeps its size and modification time.
+   * @throw CannotOpenFile If the file can not be opened or mapped.
+   */
+  static std::shared_ptr<const MappedFile> acquire_mapping(const std::string& filename, bool huge_pages);
 
 private:
   // Configuration
@@ -102,10 +179,10 @@ private:
   int m_chunk_size;
   int m_element_count;
   std::string m_source_filename;
+  bool m_use_huge_pages;
 
   // Internals
-  std::ifstream m_rawdata_ifs;
-  std::vector<std::uint8_t> m_input_buffer; // NOLINT(build/unsigned)
+  std::shared_ptr<const MappedFile> m_mapping;
 };
 
 } // namespace datahandlinglibs
@@ -0,0 +1,224 @@
+/**
+ * @file FragmentBufferPool.hpp Pool of pre-faulted, optionally NUMA local
+ * buffers in power-of-two size classes, used as fragment storage for
+ * request responses.
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_FRAGMENTBUFFERPOOL_HPP_
+#define DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_FRAGMENTBUFFERPOOL_HPP_
+
+#include "datahandlinglibs/DataHandlingIssues.hpp"
+#include "datahandlinglibs/ReadoutLogging.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <folly/MPMCQueue.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+#ifdef WITH_LIBNUMA_SUPPORT
+#include <numa.h>
+#endif
+
+using dunedaq::datahandlinglibs::logging::TLVL_WORK_STEPS;
+
+namespace dunedaq {
+namespace datahandlinglibs {
+
+/** FragmentBufferPool usage:
+ *
+ *   FragmentBufferPool pool;
+ *   pool.allocate(64 * 1024, 16 * 1024 * 1024, 4); // classes of 64kB..16MB, 4 buffers each
+ *   void* buf = pool.acquire(bytes_needed);        // nullptr if no free buffer is big enough
+ *   ...
+ *   pool.release(buf);                             // false if buf does not belong to the pool
+ *
+ * Buffers are carved out of one slab per size class, so ownership of an address can be
+ * decided without touching the buffer itself. acquire() and release() are lock-free.
+ */
+class FragmentBufferPool
+{
+public:
+  static constexpr std::size_t s_page_size = 4096;
+
+  FragmentBufferPool() {}
+
+  ~FragmentBufferPool() { free_memory(); }
+
+  FragmentBufferPool(const FragmentBufferPool&) = delete;            ///< FragmentBufferPool is not copy-constructible
+  FragmentBufferPool& operator=(const FragmentBufferPool&) = delete; ///< FragmentBufferPool is not copy-assginable
+  FragmentBufferPool(FragmentBufferPool&&) = delete;                 ///< FragmentBufferPool is not move-constructible
+  FragmentBufferPool& operator=(FragmentBufferPool&&) = delete;      ///< FragmentBufferPool is not move-assignable
+
+  /**
+   * Allocate and pre-fault the size classes.
+   * @param min_buffer_size Size of the smallest class. Rounded up to the page size.
+   * @param max_buffer_size Size of the largest class. Classes double in size until this is reached.
+   * @param buffers_per_class Number of buffers in each class.
+   * @param max_total_bytes The largest classes are dropped until the pool fits into this budget. 0 means no limit.
+   * @param numa_aware Allocate the slabs on a given NUMA node.
+   * @param numa_node The NUMA node to allocate the slabs on.
+   */
+  void allocate(std::size_t min_buffer_size,
+                std::size_t max_buffer_size,
+                std::size_t buffers_per_class,
+                std::size_t max_total_bytes = 0,
+                bool numa_aware = false,
+                uint8_t numa_node = 0) // NOLINT(build/unsigned)
+  {
+    free_memory();
+    if (buffers_per_class == 0 || max_buffer_size == 0) {
+      return;
+    }
+
+    std::vector<std::size_t> class_sizes;
+    std::size_t class_size = round_to_page(std::max(min_buffer_size, s_page_size));
+    std::size_t total_bytes = 0;
+    while (true) {
+      if (max_total_bytes > 0 && total_bytes + class_size * buffers_per_class > max_total_bytes) {
+        break;
+      }
+      class_sizes.push_back(class_size);
+      total_bytes += class_size * buffers_per_class;
+      if (class_size >= max_buffer_size) {
+        break;
+      }
+      class_size *= 2;
+    }
+
+    m_numa_aware = numa_aware;
+    m_numa_node = numa_node;
+    for (auto size : class_sizes) {
+      auto sc = std::make_unique<SizeClass>(size, buffers_per_class);
+      sc->slab = static_cast<char*>(allocate_slab(size * buffers_per_class));
+      if (sc->slab == nullptr) {
+        throw std::bad_alloc();
+      }
+      // Touch every page now, so request handling never takes the page faults
+      std::memset(sc->slab, 0, size * buffers_per_class);
+      for (std::size_t i = 0; i < buffers_per_class; ++i) {
+        sc->free_buffers.write(sc->slab + i * size);
+      }
+      m_size_classes.push_back(std::move(sc));
+    }
+    m_total_bytes = total_bytes;
+
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "FragmentBufferPool allocated " << m_size_classes.size() << " size classes, "
+                                << buffers_per_class << " buffers each, " << m_total_bytes << " bytes in total.";
+  }
+
+  /**
+   * Borrow a buffer of at least the given size. Larger classes are tried if the best fitting one is exhausted.
+   * @return Pointer to the buffer, or nullptr if no buffer is available (a pool miss).
+   */
+  void* acquire(std::size_t size)
+  {
+    for (auto& sc : m_size_classes) {
+      if (sc->buffer_size < size) {
+        continue;
+      }
+      char* buffer = nullptr;
+      if (sc->free_buffers.read(buffer)) {
+        return buffer;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * Give back a buffer obtained with acquire().
+   * @return true if the buffer belongs to the pool and was returned, false otherwise.
+   */
+  bool release(const void* buffer)
+  {
+    auto ptr = static_cast<const char*>(buffer);
+    for (auto& sc : m_size_classes) {
+      if (ptr >= sc->slab && ptr < sc->slab + sc->buffer_size * sc->num_buffers) {
+        sc->free_buffers.blockingWrite(const_cast<char*>(ptr)); // NOLINT
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Whether any size class is allocated
+  bool is_allocated() const { return !m_size_classes.empty(); }
+
+  // Size of the largest buffer that the pool can serve
+  std::size_t max_buffer_size() const { return m_size_classes.empty() ? 0 : m_size_classes.back()->buffer_size; }
+
+  // Memory held by the pool in bytes
+  std::size_t total_bytes() const { return m_total_bytes; }
+
+  // Free all the slabs. Buffers must not be in use.
+  void free_memory()
+  {
+    for (auto& sc : m_size_classes) {
+      free_slab(sc->slab, sc->buffer_size * sc->num_buffers);
+    }
+    m_size_classes.clear();
+    m_total_bytes = 0;
+  }
+
+private:
+  struct SizeClass
+  {
+    SizeClass(std::size_t size, std::size_t count)
+      : buffer_size(size)
+      , num_buffers(count)
+      , slab(nullptr)
+      , free_buffers(count)
+    {}
+
+    std::size_t buffer_size;
+    std::size_t num_buffers;
+    char* slab;
+    folly::MPMCQueue<char*> free_buffers;
+  };
+
+  static std::size_t round_to_page(std::size_t size) { return (size + s_page_size - 1) / s_page_size * s_page_size; }
+
+  void* allocate_slab(std::size_t bytes)
+  {
+    if (m_numa_aware) {
+#ifdef WITH_LIBNUMA_SUPPORT
+      return numa_alloc_onnode(bytes, m_numa_node);
+#else
+      throw GenericConfigurationError(ERS_HERE,
+                                      "NUMA allocation was requested but program was built without USE_LIBNUMA");
+#endif
+    }
+    return std::aligned_alloc(s_page_size, bytes);
+  }
+
+  void free_slab(void* slab, std::size_t bytes)
+  {
+    if (m_numa_aware) {
+#ifdef WITH_LIBNUMA_SUPPORT
+      numa_free(slab, bytes);
+#endif
+    } else {
+      std::free(slab);
+    }
+  }
+
+  std::vector<std::unique_ptr<SizeClass>> m_size_classes;
+  std::size_t m_total_bytes = 0;
+  bool m_numa_aware = false;
+  uint8_t m_numa_node = 0; // NOLINT(build/unsigned)
+};
+
+} // namespace datahandlinglibs
+} // namespace dunedaq
+
+#endif // DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_FRAGMENTBUFFERPOOL_HPP_
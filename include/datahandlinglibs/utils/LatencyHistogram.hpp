@@ -0,0 +1,162 @@
+/**
+ * @file LatencyHistogram.hpp Lock-free, log-linear latency histogram
+ * with percentile snapshots for operational monitoring.
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_LATENCYHISTOGRAM_HPP_
+#define DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_LATENCYHISTOGRAM_HPP_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace dunedaq {
+namespace datahandlinglibs {
+
+/** LatencyHistogram usage:
+ *
+ *   LatencyHistogram hist;
+ *   hist.record(elapsed_ns);                 // any thread, lock-free
+ *   auto snap = hist.snapshot_and_reset();   // publisher thread
+ *   snap.p99;                                // upper edge of the bucket holding the 99th percentile
+ *
+ * Values are binned HDR-style: exact below 16, then 16 linear sub-buckets per power of two,
+ * which bounds the relative error of a reported percentile to ~6%.
+ * Every recording thread is mapped to one of a few cache-line separated shards, so concurrent
+ * request handler threads do not contend on the same counters.
+ */
+class LatencyHistogram
+{
+public:
+  static constexpr unsigned s_sub_bucket_bits = 4;
+  static constexpr std::size_t s_sub_buckets = 1 << s_sub_bucket_bits;
+  static constexpr std::size_t s_max_shift = 40; // Values above ~2^44 end up in the last bucket
+  static constexpr std::size_t s_num_buckets = (s_max_shift + 2) * s_sub_buckets;
+  static constexpr std::size_t s_num_shards = 8;
+
+  struct Snapshot
+  {
+    uint64_t count = 0; // NOLINT(build/unsigned)
+    uint64_t sum = 0;   // NOLINT(build/unsigned)
+    uint64_t p50 = 0;   // NOLINT(build/unsigned)
+    uint64_t p90 = 0;   // NOLINT(build/unsigned)
+    uint64_t p99 = 0;   // NOLINT(build/unsigned)
+    uint64_t p999 = 0;  // NOLINT(build/unsigned)
+    uint64_t max = 0;   // NOLINT(build/unsigned)
+  };
+
+  LatencyHistogram() {}
+
+  LatencyHistogram(const LatencyHistogram&) = delete;            ///< LatencyHistogram is not copy-constructible
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete; ///< LatencyHistogram is not copy-assginable
+  LatencyHistogram(LatencyHistogram&&) = delete;                 ///< LatencyHistogram is not move-constructible
+  LatencyHistogram& operator=(LatencyHistogram&&) = delete;      ///< LatencyHistogram is not move-assignable
+
+  // Record a single value
+  void record(uint64_t value) // NOLINT(build/unsigned)
+  {
+    auto& shard = m_shards[shard_index()];
+    shard.buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(value, std::memory_order_relaxed);
+    auto current_max = shard.max.load(std::memory_order_relaxed);
+    while (value > current_max && !shard.max.compare_exchange_weak(current_max, value, std::memory_order_relaxed)) {
+    }
+  }
+
+  // Record the time elapsed since a given time point, in nanoseconds
+  template<class TimePoint>
+  void record_since(const TimePoint& since, const TimePoint& now)
+  {
+    record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - since).count());
+  }
+
+  // Collect the counts from all shards, compute the percentiles and start over
+  Snapshot snapshot_and_reset()
+  {
+    std::array<uint64_t, s_num_buckets> counts{}; // NOLINT(build/unsigned)
+    Snapshot snap;
+    for (auto& shard : m_shards) {
+      for (std::size_t i = 0; i < s_num_buckets; ++i) {
+        auto n = shard.buckets[i].exchange(0, std::memory_order_relaxed);
+        counts[i] += n;
+        snap.count += n;
+      }
+      snap.sum += shard.sum.exchange(0, std::memory_order_relaxed);
+      snap.max = std::max(snap.max, shard.max.exchange(0, std::memory_order_relaxed));
+    }
+    if (snap.count == 0) {
+      return snap;
+    }
+    // Bucket edges can overshoot the largest recorded value, which is known exactly
+    snap.p50 = std::min(percentile(counts, snap.count, 0.5), snap.max);
+    snap.p90 = std::min(percentile(counts, snap.count, 0.9), snap.max);
+    snap.p99 = std::min(percentile(counts, snap.count, 0.99), snap.max);
+    snap.p999 = std::min(percentile(counts, snap.count, 0.999), snap.max);
+    return snap;
+  }
+
+  static std::size_t bucket_of(uint64_t value) // NOLINT(build/unsigned)
+  {
+    if (value < s_sub_buckets) {
+      return value;
+    }
+    unsigned msb = 63 - __builtin_clzll(value);
+    unsigned shift = msb - s_sub_bucket_bits;
+    std::size_t index = (shift + 1) * s_sub_buckets + ((value >> shift) & (s_sub_buckets - 1));
+    return std::min(index, s_num_buckets - 1);
+  }
+
+  // Largest value that falls into the given bucket
+  static uint64_t bucket_upper_edge(std::size_t index) // NOLINT(build/unsigned)
+  {
+    if (index < s_sub_buckets) {
+      return index;
+    }
+    std::size_t shift = index / s_sub_buckets - 1;
+    uint64_t lower = (s_sub_buckets + index % s_sub_buckets) << shift; // NOLINT(build/unsigned)
+    return lower + (uint64_t(1) << shift) - 1;                          // NOLINT(build/unsigned)
+  }
+
+private:
+  struct alignas(64) Shard
+  {
+    std::array<std::atomic<uint64_t>, s_num_buckets> buckets{}; // NOLINT(build/unsigned)
+    std::atomic<uint64_t> sum{ 0 };                             // NOLINT(build/unsigned)
+    std::atomic<uint64_t> max{ 0 };                             // NOLINT(build/unsigned)
+  };
+
+  static std::size_t shard_index()
+  {
+    static std::atomic<std::size_t> next_shard{ 0 };
+    thread_local std::size_t index = next_shard.fetch_add(1, std::memory_order_relaxed) % s_num_shards;
+    return index;
+  }
+
+  static uint64_t percentile(const std::array<uint64_t, s_num_buckets>& counts, // NOLINT(build/unsigned)
+                             uint64_t total,                                    // NOLINT(build/unsigned)
+                             double fraction)
+  {
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * total + 0.5)); // NOLINT(build/unsigned)
+    uint64_t seen = 0;                                                                     // NOLINT(build/unsigned)
+    for (std::size_t i = 0; i < s_num_buckets; ++i) {
+      seen += counts[i];
+      if (seen >= rank) {
+        return bucket_upper_edge(i);
+      }
+    }
+    return bucket_upper_edge(s_num_buckets - 1);
+  }
+
+  std::array<Shard, s_num_shards> m_shards;
+};
+
+} // namespace datahandlinglibs
+} // namespace dunedaq
+
+#endif // DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_LATENCYHISTOGRAM_HPP_
@@ -0,0 +1,273 @@
+/**
+ * @file ParallelBlockCompression.hpp Block-parallel compression used by
+ * the BufferedFileWriter and BufferedFileReader "zstd-parallel" and codec
+ * modes. The stream is cut into fixed-size blocks that are encoded
+ * independently by a BlockCodec, written in order, and described by a block
+ * index kept next to the data file.
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_PARALLELBLOCKCOMPRESSION_HPP_
+#define DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_PARALLELBLOCKCOMPRESSION_HPP_
+
+#include "datahandlinglibs/DataHandlingIssues.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/iostreams/categories.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filter/zstd.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace dunedaq {
+namespace datahandlinglibs {
+
+/**
+ * One compressed block of the data file. The index file is the raw array of these entries,
+ * in stream order, stored as <data file><s_block_index_suffix>.
+ */
+struct CompressedBlockIndexEntry
+{
+  uint64_t compressed_offset;   // NOLINT(build/unsigned)
+  uint64_t compressed_size;     // NOLINT(build/unsigned)
+  uint64_t uncompressed_size;   // NOLINT(build/unsigned)
+};
+
+static constexpr const char* s_block_index_suffix = ".idx";
+
+// Compress a block into one self-contained zstd frame
+inline std::vector<char>
+compress_block(const char* data, std::size_t size)
+{
+  std::vector<char> compressed;
+  compressed.reserve(size / 2);
+  boost::iostreams::filtering_ostream out;
+  out.push(boost::iostreams::zstd_compressor(boost::iostreams::zstd::best_speed));
+  out.push(boost::iostreams::back_inserter(compressed));
+  out.write(data, size);
+  out.reset();
+  return compressed;
+}
+
+// @return false if the frame did not decompress to exactly uncompressed_size bytes
+inline bool
+decompress_block(const char* data, std::size_t size, std::vector<char>& uncompressed, std::size_t uncompressed_size)
+{
+  uncompressed.resize(uncompressed_size);
+  boost::iostreams::filtering_istream in;
+  in.push(boost::iostreams::zstd_decompressor());
+  in.push(boost::iostreams::array_source(data, size));
+  in.read(uncompressed.data(), uncompressed_size);
+  return static_cast<std::size_t>(in.gcount()) == uncompressed_size && in.get() == std::char_traits<char>::eof();
+}
+
+/**
+ * Encoding of independent blocks of the stream. Besides the zstd codec, data-specific codecs can be
+ * registered with the BufferedFileWriter and BufferedFileReader, which select them by name().
+ * encode() and decode() are called concurrently from several threads.
+ */
+class BlockCodec
+{
+public:
+  virtual ~BlockCodec() = default;
+
+  virtual std::string name() const = 0;
+
+  // Blocks are cut at multiples of this size, e.g. the size of the recorded elements
+  virtual std::size_t block_alignment() const { return 1; }
+
+  virtual std::vector<char> encode(const char* data, std::size_t size) const = 0;
+
+  // @return false if data is not an encoding of exactly decoded_size bytes
+  virtual bool decode(const char* data, std::size_t size, std::vector<char>& decoded, std::size_t decoded_size) const = 0;
+};
+
+class ZstdBlockCodec : public BlockCodec
+{
+public:
+  std::string name() const override { return "zstd-parallel"; }
+
+  std::vector<char> encode(const char* data, std::size_t size) const override { return compress_block(data, size); }
+
+  bool decode(const char* data, std::size_t size, std::vector<char>& decoded, std::size_t decoded_size) const override
+  {
+    return decompress_block(data, size, decoded, decoded_size);
+  }
+};
+
+inline bool
+write_block_index(const std::string& filename, const std::vector<CompressedBlockIndexEntry>& index)
+{
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(CompressedBlockIndexEntry)); // NOLINT
+  return out.good();
+}
+
+// @throw BufferedReaderWriterCannotOpenFile If the index can not be read.
+inline std::vector<CompressedBlockIndexEntry>
+read_block_index(const std::string& filename)
+{
+  std::ifstream in(filename, std::ios::binary | std::ios::ate);
+  if (!in.is_open()) {
+    throw BufferedReaderWriterCannotOpenFile(ERS_HERE, filename);
+  }
+  auto size = static_cast<std::size_t>(in.tellg());
+  if (size % sizeof(CompressedBlockIndexEntry) != 0) {
+    throw BufferedReaderWriterCannotOpenFile(ERS_HERE, filename);
+  }
+  std::vector<CompressedBlockIndexEntry> index(size / sizeof(CompressedBlockIndexEntry));
+  in.seekg(0);
+  in.read(reinterpret_cast<char*>(index.data()), size); // NOLINT
+  if (!in.good()) {
+    throw BufferedReaderWriterCannotOpenFile(ERS_HERE, filename);
+  }
+  return index;
+}
+
+/**
+ * boost::iostreams source decoding the blocks of a "zstd-parallel" or codec file on a pool of
+ * threads, keeping up to twice the number of threads decoded ahead of the reader.
+ * Copies share the state, as boost::iostreams copies its devices.
+ */
+class ParallelBlockSource
+{
+public:
+  using char_type = char;
+  using category = boost::iostreams::source_tag;
+
+  /**
+   * @param start_offset Offset in the uncompressed stream to start reading at.
+   * @param codec Codec the blocks were encoded with. zstd if nullptr.
+   * @throw BufferedReaderWriterCannotOpenFile If the file or its index can not be opened.
+   */
+  ParallelBlockSource(const std::string& filename,
+                      std::size_t num_threads,
+                      uint64_t start_offset = 0, // NOLINT(build/unsigned)
+                      std::shared_ptr<const BlockCodec> codec = nullptr)
+    : m_state(std::make_shared<State>(std::max<std::size_t>(num_threads, 1)))
+  {
+    m_state->codec = codec ? std::move(codec) : std::make_shared<ZstdBlockCodec>();
+    m_state->index = read_block_index(filename + s_block_index_suffix);
+    // Only the block holding the start offset and the ones after it are decompressed
+    while (m_state->next_block < m_state->index.size() &&
+           start_offset >= m_state->index[m_state->next_block].uncompressed_size) {
+      start_offset -= m_state->index[m_state->next_block++].uncompressed_size;
+    }
+    m_state->skip = start_offset;
+    m_state->fd = ::open(filename.c_str(), O_RDONLY);
+    if (m_state->fd == -1) {
+      throw BufferedReaderWriterCannotOpenFile(ERS_HERE, filename);
+    }
+    m_state->max_ahead = 2 * std::max<std::size_t>(num_threads, 1);
+  }
+
+  std::streamsize read(char* s, std::streamsize n)
+  {
+    auto& state = *m_state;
+    std::streamsize total = 0;
+    while (total < n) {
+      if (state.position == state.block.size()) {
+        prefetch();
+        if (state.ahead.empty()) {
+          break;
+        }
+        state.block = state.ahead.front().get();
+        state.ahead.pop_front();
+        if (state.block.empty()) {
+          state.position = 0;
+          break; // Corrupt block, end the stream here
+        }
+        state.position = std::min<std::size_t>(state.skip, state.block.size());
+        state.skip = 0;
+        continue;
+      }
+      auto bytes = std::min<std::size_t>(state.block.size() - state.position, n - total);
+      std::memcpy(s + total, state.block.data() + state.position, bytes);
+      state.position += bytes;
+      total += bytes;
+    }
+    return total > 0 ? total : -1;
+  }
+
+private:
+  struct State
+  {
+    explicit State(std::size_t num_threads)
+      : pool(num_threads)
+    {}
+    ~State()
+    {
+      pool.join();
+      if (fd != -1) {
+        ::close(fd);
+      }
+    }
+    boost::asio::thread_pool pool;
+    std::shared_ptr<const BlockCodec> codec;
+    std::vector<CompressedBlockIndexEntry> index;
+    int fd = -1;
+    std::size_t max_ahead = 2;
+    std::size_t next_block = 0;
+    std::deque<std::future<std::vector<char>>> ahead;
+    std::vector<char> block;
+    std::size_t position = 0;
+    uint64_t skip = 0; // NOLINT(build/unsigned)
+  };
+
+  void prefetch()
+  {
+    auto& state = *m_state;
+    while (state.ahead.size() < state.max_ahead && state.next_block < state.index.size()) {
+      auto entry = state.index[state.next_block++];
+      int fd = state.fd;
+      auto codec = state.codec;
+      auto task = std::make_shared<std::packaged_task<std::vector<char>()>>([fd, entry, codec]() {
+        std::vector<char> compressed(entry.compressed_size);
+        std::size_t done = 0;
+        while (done < compressed.size()) {
+          auto got = ::pread(fd, compressed.data() + done, compressed.size() - done, entry.compressed_offset + done);
+          if (got < 0 && errno == EINTR) {
+            continue;
+          }
+          if (got <= 0) {
+            return std::vector<char>();
+          }
+          done += got;
+        }
+        std::vector<char> uncompressed;
+        if (!codec->decode(compressed.data(), compressed.size(), uncompressed, entry.uncompressed_size)) {
+          return std::vector<char>();
+        }
+        return uncompressed;
+      });
+      state.ahead.push_back(task->get_future());
+      boost::asio::post(state.pool, [task]() { (*task)(); });
+    }
+  }
+
+  std::shared_ptr<State> m_state;
+};
+
+} // namespace datahandlinglibs
+} // namespace dunedaq
+
+#endif // DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_PARALLELBLOCKCOMPRESSION_HPP_
@@ -0,0 +1,152 @@
+/**
+ * @file ResponseCache.hpp Small LRU cache of serialized request responses,
+ * used to answer duplicate and retried data requests.
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_RESPONSECACHE_HPP_
+#define DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_RESPONSECACHE_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace dunedaq {
+namespace datahandlinglibs {
+
+/** ResponseCache usage:
+ *
+ *   ResponseCache cache;
+ *   cache.configure(64, 256 * 1024 * 1024, std::chrono::milliseconds(1000));
+ *   ResponseCache::Key key{ trigger_number, sequence_number, window_begin, window_end };
+ *   if (auto response = cache.find(key)) {
+ *     // response->data() holds a copy of the serialized fragment, header included
+ *     Fragment fragment(const_cast<char*>(response->data()), Fragment::BufferAdoptionMode::kCopyFromBuffer);
+ *   }
+ *   cache.insert(key, fragment_storage, fragment_size);
+ *
+ * Entries are evicted in least recently used order when the entry or byte budget is
+ * exceeded, and are ignored once older than the TTL. Responses are stored as copies,
+ * so they stay valid after the latency buffer moved on.
+ */
+class ResponseCache
+{
+public:
+  struct Key
+  {
+    uint64_t trigger_number;  // NOLINT(build/unsigned)
+    uint16_t sequence_number; // NOLINT(build/unsigned)
+    uint64_t window_begin;    // NOLINT(build/unsigned)
+    uint64_t window_end;      // NOLINT(build/unsigned)
+
+    bool operator<(const Key& other) const
+    {
+      return std::tie(trigger_number, sequence_number, window_begin, window_end) <
+             std::tie(other.trigger_number, other.sequence_number, other.window_begin, other.window_end);
+    }
+  };
+
+  using Response = std::shared_ptr<const std::vector<char>>;
+
+  /**
+   * @param max_entries Number of responses kept. 0 disables the cache.
+   * @param max_bytes Total size of the responses kept. 0 means no limit.
+   * @param ttl How long a response can be served from the cache.
+   */
+  void configure(std::size_t max_entries, std::size_t max_bytes, std::chrono::milliseconds ttl)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_max_entries = max_entries;
+    m_max_bytes = max_bytes;
+    m_ttl = ttl;
+    evict();
+  }
+
+  bool is_enabled() const { return m_max_entries > 0; }
+
+  // The cached response, or nullptr if there is none or it expired
+  Response find(const Key& key)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto entry = m_entries.find(key);
+    if (entry == m_entries.end()) {
+      return nullptr;
+    }
+    if (std::chrono::steady_clock::now() - entry->second.inserted > m_ttl) {
+      erase(entry);
+      return nullptr;
+    }
+    m_lru.splice(m_lru.begin(), m_lru, entry->second.lru_position);
+    return entry->second.response;
+  }
+
+  void insert(const Key& key, const void* data, std::size_t size)
+  {
+    if (!is_enabled() || (m_max_bytes > 0 && size > m_max_bytes)) {
+      return;
+    }
+    auto response = std::make_shared<const std::vector<char>>(static_cast<const char*>(data),
+                                                              static_cast<const char*>(data) + size);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto entry = m_entries.find(key);
+    if (entry != m_entries.end()) {
+      erase(entry);
+    }
+    m_lru.push_front(key);
+    m_entries.emplace(key, Entry{ std::move(response), std::chrono::steady_clock::now(), m_lru.begin() });
+    m_bytes += size;
+    evict();
+  }
+
+  void clear()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+    m_lru.clear();
+    m_bytes = 0;
+  }
+
+private:
+  struct Entry
+  {
+    Response response;
+    std::chrono::steady_clock::time_point inserted;
+    std::list<Key>::iterator lru_position;
+  };
+
+  void erase(std::map<Key, Entry>::iterator entry)
+  {
+    m_bytes -= entry->second.response->size();
+    m_lru.erase(entry->second.lru_position);
+    m_entries.erase(entry);
+  }
+
+  void evict()
+  {
+    while (!m_lru.empty() && (m_entries.size() > m_max_entries || (m_max_bytes > 0 && m_bytes > m_max_bytes))) {
+      erase(m_entries.find(m_lru.back()));
+    }
+  }
+
+  std::map<Key, Entry> m_entries;
+  std::list<Key> m_lru; // Most recently used first
+  std::size_t m_bytes = 0;
+  std::size_t m_max_entries = 0;
+  std::size_t m_max_bytes = 0;
+  std::chrono::milliseconds m_ttl{ 0 };
+  std::mutex m_mutex;
+};
+
+} // namespace datahandlinglibs
+} // namespace dunedaq
+
+#endif // DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_RESPONSECACHE_HPP_
@@ -0,0 +1,167 @@
+/**
+ * @file StripedFile.hpp Layout of a logical stream striped round-robin over
+ * several files, its manifest, and a boost::iostreams source reading the
+ * striped set back as one stream.
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_STRIPEDFILE_HPP_
+#define DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_STRIPEDFILE_HPP_
+
+#include "datahandlinglibs/DataHandlingIssues.hpp"
+
+#include <boost/iostreams/categories.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace dunedaq {
+namespace datahandlinglibs {
+
+/**
+ * Where a byte of the logical stream lives: stripe units of stripe_size bytes go to the
+ * files in turn, so unit u is stored in file u % num_files at offset (u / num_files) * stripe_size.
+ * A layout without files or with an empty stripe size has no location, contiguous is then 0.
+ */
+struct StripeLocation
+{
+  std::size_t file;
+  uint64_t offset;        // NOLINT(build/unsigned)
+  std::size_t contiguous; // Bytes left in the stripe unit
+};
+
+inline StripeLocation
+locate_stripe(uint64_t logical_offset, std::size_t stripe_size, std::size_t num_files) // NOLINT(build/unsigned)
+{
+  if (num_files == 0 || stripe_size == 0) {
+    return { 0, logical_offset, 0 };
+  }
+  uint64_t unit = logical_offset / stripe_size; // NOLINT(build/unsigned)
+  std::size_t in_unit = logical_offset % stripe_size;
+  return { static_cast<std::size_t>(unit % num_files), (unit / num_files) * stripe_size + in_unit, stripe_size - in_unit };
+}
+
+/**
+ * Manifest of a striped recording. Text file with a "stripe_size <bytes>" line followed
+ * by one line per file, in stripe order.
+ */
+struct StripeManifest
+{
+  static constexpr const char* s_suffix = ".manifest";
+
+  std::size_t stripe_size = 0;
+  std::vector<std::string> files;
+
+  static bool is_manifest(const std::string& filename)
+  {
+    const std::string suffix(s_suffix);
+    return filename.size() > suffix.size() && filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) == 0;
+  }
+
+  // @throw BufferedReaderWriterCannotOpenFile If the manifest can not be read.
+  static StripeManifest read(const std::string& filename)
+  {
+    StripeManifest manifest;
+    std::ifstream in(filename);
+    std::string key;
+    if (!(in >> key >> manifest.stripe_size) || key != "stripe_size" || manifest.stripe_size == 0) {
+      throw BufferedReaderWriterCannotOpenFile(ERS_HERE, filename);
+    }
+    std::string file;
+    while (in >> file) {
+      manifest.files.push_back(file);
+    }
+    if (manifest.files.empty()) {
+      throw BufferedReaderWriterCannotOpenFile(ERS_HERE, filename);
+    }
+    return manifest;
+  }
+
+  bool write(const std::string& filename) const
+  {
+    std::ofstream out(filename, std::ios::trunc);
+    out << "stripe_size " << stripe_size << "\n";
+    for (const auto& file : files) {
+      out << file << "\n";
+    }
+    return out.good();
+  }
+};
+
+/**
+ * boost::iostreams source reading the files of a manifest as one logical stream.
+ * Copies share the open files, as boost::iostreams copies its devices.
+ */
+class StripedFileSource
+{
+public:
+  using char_type = char;
+  using category = boost::iostreams::source_tag;
+
+  // @throw BufferedReaderWriterCannotOpenFile If one of the files can not be opened.
+  explicit StripedFileSource(const StripeManifest& manifest, uint64_t start_offset = 0) // NOLINT(build/unsigned)
+    : m_state(std::make_shared<State>())
+  {
+    m_state->stripe_size = manifest.stripe_size;
+    m_state->position = start_offset;
+    for (const auto& file : manifest.files) {
+      int fd = ::open(file.c_str(), O_RDONLY);
+      if (fd == -1) {
+        throw BufferedReaderWriterCannotOpenFile(ERS_HERE, file);
+      }
+      m_state->fds.push_back(fd);
+    }
+  }
+
+  std::streamsize read(char* s, std::streamsize n)
+  {
+    std::streamsize total = 0;
+    while (total < n) {
+      auto loc = locate_stripe(m_state->position, m_state->stripe_size, m_state->fds.size());
+      auto wanted = std::min<std::size_t>(loc.contiguous, n - total);
+      auto got = ::pread(m_state->fds[loc.file], s + total, wanted, loc.offset);
+      if (got < 0 && errno == EINTR) {
+        continue;
+      }
+      if (got <= 0) {
+        break; // The stream ends where the first file runs out
+      }
+      total += got;
+      m_state->position += got;
+    }
+    return total > 0 ? total : -1;
+  }
+
+private:
+  struct State
+  {
+    ~State()
+    {
+      for (int fd : fds) {
+        ::close(fd);
+      }
+    }
+    std::vector<int> fds;
+    std::size_t stripe_size = 0;
+    uint64_t position = 0; // NOLINT(build/unsigned)
+  };
+
+  std::shared_ptr<State> m_state;
+};
+
+} // namespace datahandlinglibs
+} // namespace dunedaq
+
+#endif // DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_STRIPEDFILE_HPP_
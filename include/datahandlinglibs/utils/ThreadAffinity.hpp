@@ -0,0 +1,98 @@
+/**
+ * @file ThreadAffinity.hpp Helpers to build CPU masks from NUMA nodes or
+ * CPU lists, and to pin and name the calling thread.
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_THREADAFFINITY_HPP_
+#define DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_THREADAFFINITY_HPP_
+
+#include "datahandlinglibs/DataHandlingIssues.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#ifdef WITH_LIBNUMA_SUPPORT
+#include <numa.h>
+#endif
+
+namespace dunedaq {
+namespace datahandlinglibs {
+
+/**
+ * Parse a CPU list in the usual "0-3,8,10-11" notation into a CPU mask.
+ * Throws GenericConfigurationError on malformed input.
+ */
+inline cpu_set_t
+cpu_set_from_list(const std::string& cpu_list)
+{
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  std::stringstream ss(cpu_list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    if (range.empty()) {
+      continue;
+    }
+    try {
+      auto dash = range.find('-');
+      int first = std::stoi(range.substr(0, dash));
+      int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+      for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+        CPU_SET(cpu, &mask);
+      }
+    } catch (const std::exception&) {
+      throw GenericConfigurationError(ERS_HERE, "Malformed CPU list: " + cpu_list);
+    }
+  }
+  return mask;
+}
+
+/**
+ * CPU mask of all the CPUs of a NUMA node. Empty if built without libnuma.
+ */
+inline cpu_set_t
+cpu_set_from_numa_node(uint8_t numa_node) // NOLINT(build/unsigned)
+{
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+#ifdef WITH_LIBNUMA_SUPPORT
+  struct bitmask* nodecpumask = numa_allocate_cpumask();
+  if (numa_node_to_cpus(numa_node, nodecpumask) == 0) {
+    for (int i = 0; i < numa_num_configured_cpus(); ++i) {
+      if (numa_bitmask_isbitset(nodecpumask, i)) {
+        CPU_SET(i, &mask);
+      }
+    }
+  }
+  numa_free_cpumask(nodecpumask);
+#else
+  (void)numa_node;
+#endif
+  return mask;
+}
+
+/**
+ * Name the calling thread (truncated to 15 characters) and, if the mask is not empty, pin it.
+ * @return true if the affinity was applied or there was nothing to apply.
+ */
+inline bool
+name_and_pin_current_thread(const std::string& name, const cpu_set_t& mask)
+{
+  pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+  if (CPU_COUNT(&mask) == 0) {
+    return true;
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &mask) == 0;
+}
+
+} // namespace datahandlinglibs
+} // namespace dunedaq
+
+#endif // DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_THREADAFFINITY_HPP_
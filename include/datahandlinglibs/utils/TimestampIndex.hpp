@@ -0,0 +1,98 @@
+/**
+ * @file TimestampIndex.hpp Sidecar timestamp index of a recorded file,
+ * mapping timestamps to offsets in the uncompressed stream so that a reader
+ * can seek to a time range instead of reading from the beginning.
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_TIMESTAMPINDEX_HPP_
+#define DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_TIMESTAMPINDEX_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dunedaq {
+namespace datahandlinglibs {
+
+/**
+ * Layout of <data file><s_suffix>: a Header followed by Entry records in stream order.
+ * Entries are taken at element boundaries, at most one per configured interval of bytes.
+ * Offsets are in the uncompressed stream, whatever compression the data file uses.
+ */
+struct TimestampIndex
+{
+  static constexpr const char* s_suffix = ".tsidx";
+  static constexpr uint32_t s_version = 1; // NOLINT(build/unsigned)
+
+  struct Header
+  {
+    char magic[8] = { 'D', 'H', 'L', 'T', 'S', 'I', 'D', 'X' };
+    uint32_t version = s_version; // NOLINT(build/unsigned)
+    uint32_t element_size = 0;    // NOLINT(build/unsigned)
+    uint32_t element_type = 0;    // Type tag of the elements, e.g. the fragment type. 0 if unspecified. // NOLINT(build/unsigned)
+    uint32_t reserved = 0;        // NOLINT(build/unsigned)
+  };
+
+  struct Entry
+  {
+    uint64_t timestamp; // NOLINT(build/unsigned)
+    uint64_t offset;    // NOLINT(build/unsigned)
+  };
+
+  Header header;
+  std::vector<Entry> entries;
+
+  // Offset of the last indexed element with a timestamp not after the given one, 0 if there is none
+  uint64_t offset_before(uint64_t timestamp) const // NOLINT(build/unsigned)
+  {
+    auto after = std::upper_bound(
+      entries.begin(), entries.end(), timestamp, [](uint64_t ts, const Entry& entry) { return ts < entry.timestamp; }); // NOLINT(build/unsigned)
+    return after == entries.begin() ? 0 : std::prev(after)->offset;
+  }
+
+  bool write(const std::string& filename) const
+  {
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));                         // NOLINT
+    out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry)); // NOLINT
+    return out.good();
+  }
+
+  // @return false if the file does not exist or is not a timestamp index
+  bool read(const std::string& filename)
+  {
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in.is_open()) {
+      return false;
+    }
+    auto size = static_cast<std::size_t>(in.tellg());
+    in.seekg(0);
+    Header read_header;
+    if (size < sizeof(Header) || (size - sizeof(Header)) % sizeof(Entry) != 0 ||
+        !in.read(reinterpret_cast<char*>(&read_header), sizeof(read_header)) || // NOLINT
+        std::memcmp(read_header.magic, Header().magic, sizeof(read_header.magic)) != 0 ||
+        read_header.version != s_version) {
+      return false;
+    }
+    std::vector<Entry> read_entries((size - sizeof(Header)) / sizeof(Entry));
+    if (!in.read(reinterpret_cast<char*>(read_entries.data()), read_entries.size() * sizeof(Entry))) { // NOLINT
+      return false;
+    }
+    header = read_header;
+    entries = std::move(read_entries);
+    return true;
+  }
+};
+
+} // namespace datahandlinglibs
+} // namespace dunedaq
+
+#endif // DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_TIMESTAMPINDEX_HPP_
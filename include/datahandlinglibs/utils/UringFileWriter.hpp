@@ -0,0 +1,392 @@
+/**
+ * @file UringFileWriter.hpp Asynchronous file writer that keeps several writes
+ * in flight with io_uring, using registered buffers and fixed file
+ * descriptors. Falls back to synchronous writes without liburing.
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_URINGFILEWRITER_HPP_
+#define DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_URINGFILEWRITER_HPP_
+
+#include "datahandlinglibs/ReadoutLogging.hpp"
+#include "datahandlinglibs/utils/StripedFile.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef WITH_LIBURING_SUPPORT
+#include <liburing.h>
+#endif
+
+using dunedaq::datahandlinglibs::logging::TLVL_WORK_STEPS;
+
+namespace dunedaq {
+namespace datahandlinglibs {
+
+/** UringFileWriter usage:
+ *
+ *   UringFileWriter writer;
+ *   writer.open(fd, 8, buffer, buffer_size); // up to 8 writes in flight, all taken from buffer
+ *   writer.write(ptr, 1024 * 1024);          // returns once the write is queued
+ *   writer.oldest_pending();                 // memory up to here may be reused
+ *   writer.write_sync(tail, tail_size);      // e.g. for a write that needs other file flags
+ *   writer.close();                          // waits for the writes in flight, the fd stays open
+ *
+ * Writes are appended at increasing file offsets and may complete out of order. Short writes
+ * are resubmitted for the remaining bytes. Without WITH_LIBURING_SUPPORT, or with a queue
+ * depth of 0, every write is done synchronously with pwrite().
+ *
+ * set_max_write_size() caps the size of a single write, larger ones then complete in several
+ * pieces exactly like short writes.
+ *
+ * Given several file descriptors, the appended stream is striped round-robin over them in
+ * units of stripe_size bytes (see StripedFile.hpp). Writes are split at unit boundaries.
+ */
+class UringFileWriter
+{
+public:
+#ifdef WITH_LIBURING_SUPPORT
+  static constexpr unsigned s_default_queue_depth = 8;
+#else
+  static constexpr unsigned s_default_queue_depth = 0;
+#endif
+
+  UringFileWriter() {}
+
+  ~UringFileWriter() { close(); }
+
+  UringFileWriter(const UringFileWriter&) = delete;            ///< UringFileWriter is not copy-constructible
+  UringFileWriter& operator=(const UringFileWriter&) = delete; ///< UringFileWriter is not copy-assginable
+  UringFileWriter(UringFileWriter&&) = delete;                 ///< UringFileWriter is not move-constructible
+  UringFileWriter& operator=(UringFileWriter&&) = delete;      ///< UringFileWriter is not move-assignable
+
+  /**
+   * Start writing to an open file descriptor. The descriptor is not owned by the writer.
+   * @param queue_depth Maximum number of writes in flight. 0 writes synchronously.
+   * @param region Memory all writes are taken from, registered with the kernel. Can be nullptr.
+   * @param file_offset Offset of the first write in the file.
+   * @return false if io_uring could not be set up. The writer then works synchronously.
+   */
+  bool open(int fd, unsigned queue_depth, const void* region = nullptr, std::size_t region_size = 0,
+            uint64_t file_offset = 0) // NOLINT(build/unsigned)
+  {
+    return open(std::vector<int>{ fd }, std::numeric_limits<std::size_t>::max(), queue_depth, region, region_size,
+                file_offset);
+  }
+
+  /**
+   * Start writing a stream striped over several open file descriptors.
+   * @param stripe_size Bytes written to one file before moving to the next one.
+   * @param file_offset Offset of the first write in the logical stream.
+   * @return false if there is no file to write to, or io_uring could not be set up.
+   */
+  bool open(const std::vector<int>& fds, std::size_t stripe_size, unsigned queue_depth,
+            const void* region = nullptr, std::size_t region_size = 0,
+            uint64_t file_offset = 0) // NOLINT(build/unsigned)
+  {
+    close();
+    m_offset = file_offset;
+    m_failed_writes = 0;
+    if (fds.empty() || stripe_size == 0) {
+      TLOG() << "No output file to write to";
+      return false;
+    }
+    m_fds = fds;
+    m_stripe_size = stripe_size;
+#ifdef WITH_LIBURING_SUPPORT
+    if (queue_depth == 0) {
+      return true;
+    }
+    if (io_uring_queue_init(queue_depth, &m_ring, 0) < 0) {
+      TLOG() << "Could not set up io_uring, writing synchronously";
+      return false;
+    }
+    m_async = true;
+    m_slots.assign(queue_depth, InFlight());
+    m_fixed_file = io_uring_register_files(&m_ring, m_fds.data(), m_fds.size()) == 0;
+    if (region != nullptr && region_size > 0) {
+      // A single registered buffer is limited to 1GB
+      const char* base = static_cast<const char*>(region);
+      for (std::size_t offset = 0; offset < region_size; offset += s_max_registered_buffer) {
+        m_iovecs.push_back({ const_cast<char*>(base + offset), // NOLINT
+                             std::min(s_max_registered_buffer, region_size - offset) });
+      }
+      if (io_uring_register_buffers(&m_ring, m_iovecs.data(), m_iovecs.size()) != 0) {
+        TLOG_DEBUG(TLVL_WORK_STEPS) << "Could not register the write buffers, using plain writes";
+        m_iovecs.clear();
+      }
+    }
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "io_uring writer with queue depth " << queue_depth << ", fixed file "
+                                << m_fixed_file << ", " << m_iovecs.size() << " registered buffers";
+#else
+    (void)queue_depth;
+    (void)region;
+    (void)region_size;
+#endif
+    return true;
+  }
+
+  bool is_open() const { return !m_fds.empty(); }
+
+  // Largest number of bytes handed to the kernel in one write
+  void set_max_write_size(std::size_t max_write_size) { m_max_write_size = std::max<std::size_t>(max_write_size, 1); }
+
+  bool is_async() const { return m_async; }
+
+  /**
+   * Append data to the file. With io_uring this returns once the write is queued, blocking
+   * while the queue is full. The memory must not be modified before the write completed.
+   * @return false if this or a previously completed write failed since the last call.
+   */
+  bool write(const void* data, std::size_t size)
+  {
+    auto failed_before = m_failed_writes;
+    const char* piece = static_cast<const char*>(data);
+    while (size > 0) {
+      auto loc = locate_stripe(m_offset, m_stripe_size, m_fds.size());
+      if (loc.contiguous == 0) {
+        // Not open
+        ++m_failed_writes;
+        break;
+      }
+      auto piece_size = std::min(size, loc.contiguous);
+      bool queued = false;
+#ifdef WITH_LIBURING_SUPPORT
+      if (m_async) {
+        auto slot = free_slot();
+        m_slots[slot] = InFlight{ piece, piece_size, loc.file, loc.offset, m_offset, true };
+        submit(slot);
+        queued = true;
+      }
+#endif
+      if (!queued && !pwrite_fully(m_fds[loc.file], piece, piece_size, loc.offset, m_max_write_size)) {
+        ++m_failed_writes;
+      }
+      piece += piece_size;
+      size -= piece_size;
+      m_offset += piece_size;
+    }
+#ifdef WITH_LIBURING_SUPPORT
+    if (m_async) {
+      reap(false);
+    }
+#endif
+    return m_failed_writes == failed_before;
+  }
+
+  // Wait for the writes in flight, then write on the calling thread
+  bool write_sync(const void* data, std::size_t size)
+  {
+    bool ok = drain();
+    bool async = m_async;
+    m_async = false;
+    ok &= write(data, size);
+    m_async = async;
+    return ok;
+  }
+
+  // Wait until no write is in flight. False if a write failed since the last call.
+  bool drain()
+  {
+    auto failed_before = m_failed_writes;
+#ifdef WITH_LIBURING_SUPPORT
+    while (m_async && m_in_flight > 0) {
+      reap(true);
+    }
+#endif
+    return m_failed_writes == failed_before;
+  }
+
+  // Start of the oldest write that did not complete yet, nullptr if none is in flight
+  const void* oldest_pending()
+  {
+    const void* oldest = nullptr;
+#ifdef WITH_LIBURING_SUPPORT
+    if (m_async) {
+      reap(false);
+      uint64_t oldest_offset = std::numeric_limits<uint64_t>::max(); // NOLINT(build/unsigned)
+      for (const auto& slot : m_slots) {
+        if (slot.busy && slot.logical_offset < oldest_offset) {
+          oldest_offset = slot.logical_offset;
+          oldest = slot.data;
+        }
+      }
+    }
+#endif
+    return oldest;
+  }
+
+  uint64_t file_offset() const { return m_offset; } // NOLINT(build/unsigned)
+
+  std::size_t failed_writes() const { return m_failed_writes; }
+
+  void close()
+  {
+    drain();
+#ifdef WITH_LIBURING_SUPPORT
+    if (m_async) {
+      if (!m_iovecs.empty()) {
+        io_uring_unregister_buffers(&m_ring);
+      }
+      if (m_fixed_file) {
+        io_uring_unregister_files(&m_ring);
+      }
+      io_uring_queue_exit(&m_ring);
+    }
+    m_slots.clear();
+    m_iovecs.clear();
+    m_fixed_file = false;
+#endif
+    m_async = false;
+    m_fds.clear();
+  }
+
+  // pwrite() the whole range, at most max_write_size bytes at a time, continuing after short writes and interruptions
+  static bool pwrite_fully(int fd, const char* data, std::size_t size, uint64_t offset, // NOLINT(build/unsigned)
+                           std::size_t max_write_size = std::numeric_limits<std::size_t>::max())
+  {
+    while (size > 0) {
+      auto written = ::pwrite(fd, data, std::min(size, max_write_size), offset);
+      if (written < 0 && errno == EINTR) {
+        continue;
+      }
+      if (written <= 0) {
+        return false;
+      }
+      data += written;
+      size -= written;
+      offset += written;
+    }
+    return true;
+  }
+
+private:
+#ifdef WITH_LIBURING_SUPPORT
+  static constexpr std::size_t s_max_registered_buffer = 1UL << 30;
+
+  struct InFlight
+  {
+    const char* data = nullptr;
+    std::size_t size = 0;
+    std::size_t file = 0;
+    uint64_t offset = 0;         // NOLINT(build/unsigned)
+    uint64_t logical_offset = 0; // NOLINT(build/unsigned)
+    bool busy = false;
+  };
+
+  std::size_t free_slot()
+  {
+    while (true) {
+      for (std::size_t i = 0; i < m_slots.size(); ++i) {
+        if (!m_slots[i].busy) {
+          return i;
+        }
+      }
+      reap(true);
+    }
+  }
+
+  void submit(std::size_t slot_index)
+  {
+    auto& slot = m_slots[slot_index];
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+    if (sqe == nullptr) {
+      // Cannot happen with at most queue_depth writes in flight, but never lose data
+      if (!pwrite_fully(m_fds[slot.file], slot.data, slot.size, slot.offset, m_max_write_size)) {
+        ++m_failed_writes;
+      }
+      slot.busy = false;
+      return;
+    }
+    int fd = m_fixed_file ? static_cast<int>(slot.file) : m_fds[slot.file];
+    // A capped write completes short, reap() submits the rest
+    auto size = std::min(slot.size, m_max_write_size);
+    int buf_index = registered_buffer(slot.data, size);
+    if (buf_index >= 0) {
+      io_uring_prep_write_fixed(sqe, fd, slot.data, size, slot.offset, buf_index);
+    } else {
+      io_uring_prep_write(sqe, fd, slot.data, size, slot.offset);
+    }
+    if (m_fixed_file) {
+      sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(slot_index)); // NOLINT
+    io_uring_submit(&m_ring);
+    ++m_in_flight;
+  }
+
+  // Index of the registered buffer holding the whole range, -1 if there is none
+  int registered_buffer(const char* data, std::size_t size) const
+  {
+    for (std::size_t i = 0; i < m_iovecs.size(); ++i) {
+      const char* base = static_cast<const char*>(m_iovecs[i].iov_base);
+      if (data >= base && data + size <= base + m_iovecs[i].iov_len) {
+        return static_cast<int>(i);
+      }
+    }
+    return -1;
+  }
+
+  // Process completions. With wait, block until at least one is available.
+  void reap(bool wait)
+  {
+    struct io_uring_cqe* cqe = nullptr;
+    if (wait && m_in_flight > 0) {
+      if (io_uring_wait_cqe(&m_ring, &cqe) < 0) {
+        return;
+      }
+    }
+    while (io_uring_peek_cqe(&m_ring, &cqe) == 0 && cqe != nullptr) {
+      auto slot_index = reinterpret_cast<std::size_t>(io_uring_cqe_get_data(cqe)); // NOLINT
+      int res = cqe->res;
+      io_uring_cqe_seen(&m_ring, cqe);
+      --m_in_flight;
+      auto& slot = m_slots[slot_index];
+      if (res == -EINTR || res == -EAGAIN) {
+        submit(slot_index);
+      } else if (res <= 0) {
+        ++m_failed_writes;
+        slot.busy = false;
+      } else if (static_cast<std::size_t>(res) < slot.size) {
+        // Short write: queue the rest
+        slot.data += res;
+        slot.size -= res;
+        slot.offset += res;
+        slot.logical_offset += res;
+        submit(slot_index);
+      } else {
+        slot.busy = false;
+      }
+    }
+  }
+
+  struct io_uring m_ring;
+  std::vector<InFlight> m_slots;
+  std::vector<struct iovec> m_iovecs;
+  bool m_fixed_file = false;
+#endif
+
+  std::vector<int> m_fds;
+  std::size_t m_stripe_size = std::numeric_limits<std::size_t>::max();
+  uint64_t m_offset = 0; // NOLINT(build/unsigned)
+  std::size_t m_max_write_size = std::numeric_limits<std::size_t>::max();
+  std::size_t m_in_flight = 0;
+  std::size_t m_failed_writes = 0;
+  bool m_async = false;
+};
+
+} // namespace datahandlinglibs
+} // namespace dunedaq
+
+#endif // DATAHANDLINGLIBS_INCLUDE_DATAHANDLINGLIBS_UTILS_URINGFILEWRITER_HPP_
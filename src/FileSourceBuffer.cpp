@@ -0,0 +1,45 @@
+/**
+ * @file FileSourceBuffer.cpp Process-wide cache of the file mappings used by FileSourceBuffer
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "datahandlinglibs/utils/FileSourceBuffer.hpp"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <sys/stat.h>
+
+namespace dunedaq {
+namespace datahandlinglibs {
+
+namespace {
+std::mutex s_mappings_mutex;
+std::map<std::string, std::weak_ptr<const MappedFile>> s_mappings;
+} // namespace
+
+std::shared_ptr<const MappedFile>
+FileSourceBuffer::acquire_mapping(const std::string& filename, bool huge_pages)
+{
+  std::lock_guard<std::mutex> lock(s_mappings_mutex);
+  struct stat file_stat;
+  if (::stat(filename.c_str(), &file_stat) != 0) {
+    throw CannotOpenFile(ERS_HERE, filename);
+  }
+  auto cached = s_mappings[filename].lock();
+  if (cached && cached->matches(file_stat)) {
+    TLOG_DEBUG(TLVL_BOOKKEEPING) << "Sharing the mapping of " << filename;
+    return cached;
+  }
+  auto mapping = std::make_shared<const MappedFile>(filename, huge_pages);
+  s_mappings[filename] = mapping;
+  return mapping;
+}
+
+} // namespace datahandlinglibs
+} // namespace dunedaq
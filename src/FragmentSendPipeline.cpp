@@ -0,0 +1,224 @@
+/**
+ * @file FragmentSendPipeline.cpp
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "datahandlinglibs/FragmentSendPipeline.hpp"
+#include "datahandlinglibs/DataHandlingIssues.hpp"
+#include "datahandlinglibs/ReadoutLogging.hpp"
+#include "datahandlinglibs/opmon/datahandling_info.pb.h"
+
+#include "logging/Logging.hpp"
+
+#include <pthread.h>
+
+#include <mutex>
+#include <string>
+#include <utility>
+
+using dunedaq::datahandlinglibs::logging::TLVL_WORK_STEPS;
+
+namespace dunedaq {
+namespace datahandlinglibs {
+
+FragmentSendPipeline::FragmentSendPipeline(daqdataformats::SourceID sourceid,
+                                           std::chrono::milliseconds send_timeout,
+                                           std::size_t max_queue_depth,
+                                           OnSentCallback on_sent)
+  : m_sourceid(sourceid)
+  , m_send_timeout(send_timeout)
+  , m_max_queue_depth(max_queue_depth)
+  , m_on_sent(std::move(on_sent))
+{
+}
+
+FragmentSendPipeline::~FragmentSendPipeline()
+{
+  stop();
+}
+
+bool
+FragmentSendPipeline::add_destination(const std::string& destination)
+{
+  return get_destination(destination) != nullptr;
+}
+
+void
+FragmentSendPipeline::start()
+{
+  std::unique_lock<std::shared_mutex> lock(m_destinations_mutex);
+  for (auto& [uid, dest] : m_destinations) {
+    start_worker(*dest);
+  }
+  m_running.store(true);
+}
+
+void
+FragmentSendPipeline::stop()
+{
+  {
+    // Once the flag is flipped under the exclusive lock, no sender thread can get new fragments
+    std::unique_lock<std::shared_mutex> lock(m_destinations_mutex);
+    m_running.store(false);
+    for (auto& [uid, dest] : m_destinations) {
+      dest->running.store(false);
+    }
+  }
+  for (auto& [uid, dest] : m_destinations) {
+    if (dest->worker.joinable()) {
+      dest->worker.join();
+    }
+  }
+}
+
+void
+FragmentSendPipeline::clear_destinations()
+{
+  stop();
+  std::unique_lock<std::shared_mutex> lock(m_destinations_mutex);
+  m_destinations.clear();
+}
+
+bool
+FragmentSendPipeline::send(FragmentPtr fragment, const std::string& destination)
+{
+  auto dest_ptr = get_destination(destination);
+  if (dest_ptr == nullptr) {
+    // Nothing can be sent to it, the buffer goes back right away
+    const void* storage = fragment->get_storage_location();
+    fragment.reset();
+    if (m_on_sent) {
+      m_on_sent(storage);
+    }
+    return false;
+  }
+  auto& dest = *dest_ptr;
+  {
+    std::shared_lock<std::shared_mutex> lock(m_destinations_mutex);
+    if (m_running.load()) {
+      if (dest.queue_depth.fetch_add(1) < m_max_queue_depth) {
+        dest.queue.enqueue(QueuedFragment{ std::move(fragment), std::chrono::steady_clock::now() });
+        return true;
+      }
+      // Queue full: the calling thread waits for its own send, as without the pipeline
+      --dest.queue_depth;
+      ++dest.num_sent_directly;
+    }
+  }
+  // Not running or queue full: send on the calling thread
+  return send_now(dest, std::move(fragment));
+}
+
+bool
+FragmentSendPipeline::send_now(Destination& dest, FragmentPtr fragment)
+{
+  bool sent = true;
+  const void* storage = fragment->get_storage_location();
+  try {
+    dest.sender->send(std::move(fragment), m_send_timeout);
+    ++dest.num_sent;
+  } catch (const ers::Issue& excpt) {
+    ++dest.num_send_failed;
+    ers::warning(CannotWriteToQueue(ERS_HERE, m_sourceid, dest.uid, excpt));
+    sent = false;
+  }
+  if (m_on_sent) {
+    m_on_sent(storage);
+  }
+  return sent;
+}
+
+FragmentSendPipeline::Destination*
+FragmentSendPipeline::get_destination(const std::string& destination)
+{
+  {
+    std::shared_lock<std::shared_mutex> lock(m_destinations_mutex);
+    auto dest = m_destinations.find(destination);
+    if (dest != m_destinations.end()) {
+      return dest->second.get();
+    }
+  }
+  // The sender lookup is done once per destination
+  std::shared_ptr<iomanager::SenderConcept<FragmentPtr>> sender;
+  try {
+    sender = get_iom_sender<FragmentPtr>(destination);
+  } catch (const ers::Issue& excpt) {
+    ers::warning(CannotWriteToQueue(ERS_HERE, m_sourceid, destination, excpt));
+    return nullptr;
+  }
+  std::unique_lock<std::shared_mutex> lock(m_destinations_mutex);
+  auto& dest = m_destinations[destination];
+  if (dest == nullptr) {
+    dest = std::make_unique<Destination>();
+    dest->uid = destination;
+    dest->sender = sender;
+    if (m_running.load()) {
+      start_worker(*dest);
+    }
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "Added fragment destination " << destination << " for SourceID[" << m_sourceid
+                                << "]";
+  }
+  return dest.get();
+}
+
+void
+FragmentSendPipeline::start_worker(Destination& dest)
+{
+  if (dest.worker.joinable()) {
+    return;
+  }
+  dest.running.store(true);
+  dest.worker = std::thread(&FragmentSendPipeline::run_sender, this, std::ref(dest));
+  std::string name = "fragsend-" + std::to_string(m_sourceid.id);
+  pthread_setname_np(dest.worker.native_handle(), name.substr(0, 15).c_str());
+}
+
+void
+FragmentSendPipeline::run_sender(Destination& dest)
+{
+  QueuedFragment queued;
+  while (dest.running.load() || dest.queue_depth.load() > 0) {
+    if (!dest.queue.try_dequeue_for(queued, std::chrono::milliseconds(10))) {
+      continue;
+    }
+    --dest.queue_depth;
+    const void* storage = queued.fragment->get_storage_location();
+    try {
+      dest.sender->send(std::move(queued.fragment), m_send_timeout);
+      ++dest.num_sent;
+    } catch (const ers::Issue& excpt) {
+      ++dest.num_send_failed;
+      ers::warning(CannotWriteToQueue(ERS_HERE, m_sourceid, dest.uid, excpt));
+    }
+    queued.fragment.reset();
+    if (m_on_sent) {
+      m_on_sent(storage);
+    }
+    dest.send_latency.record(
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - queued.enqueued).count());
+  }
+}
+
+void
+FragmentSendPipeline::generate_opmon_data()
+{
+  std::shared_lock<std::shared_mutex> lock(m_destinations_mutex);
+  for (auto& [uid, dest] : m_destinations) {
+    auto latency = dest->send_latency.snapshot_and_reset();
+    opmon::FragmentSenderInfo info;
+    info.set_queue_depth(dest->queue_depth.load());
+    info.set_num_fragments_sent(dest->num_sent.exchange(0));
+    info.set_num_send_failed(dest->num_send_failed.exchange(0));
+    info.set_num_sent_directly(dest->num_sent_directly.exchange(0));
+    info.set_p50_send_latency(latency.p50);
+    info.set_p99_send_latency(latency.p99);
+    info.set_max_send_latency(latency.max);
+    this->publish(std::move(info), { { "destination", uid } });
+  }
+}
+
+} // namespace datahandlinglibs
+} // namespace dunedaq
@@ -0,0 +1,358 @@
+/**
+ * @file test_request_replay_app.cxx Benchmark of the request handlers:
+ * fills a latency buffer with synthetic frames at a target rate and fires
+ * data requests against it, reporting throughput and response times.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#include "datahandlinglibs/models/BinarySearchQueueModel.hpp"
+#include "datahandlinglibs/models/DefaultRequestHandlerModel.hpp"
+#include "datahandlinglibs/models/DefaultSkipListRequestHandler.hpp"
+#include "datahandlinglibs/models/FixedRateQueueModel.hpp"
+#include "datahandlinglibs/models/SkipListLatencyBufferModel.hpp"
+#include "datahandlinglibs/utils/LatencyHistogram.hpp"
+#include "datahandlinglibs/utils/RateLimiter.hpp"
+
+#include "daqdataformats/Fragment.hpp"
+#include "dfmessages/DataRequest.hpp"
+#include "logging/Logging.hpp"
+
+#include "CLI/App.hpp"
+#include "CLI/Config.hpp"
+#include "CLI/Formatter.hpp"
+
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace dunedaq::datahandlinglibs;
+using dunedaq::daqdataformats::Fragment;
+using dunedaq::daqdataformats::SourceID;
+using dunedaq::dfmessages::DataRequest;
+
+namespace {
+
+// Aggregated element in the spirit of types::DUMMY_FRAME_STRUCT, with the
+// interface the request handlers expect from readout types
+const constexpr std::size_t frames_per_element = 12;
+const constexpr uint64_t tick_difference = 32; // NOLINT(build/unsigned)
+
+struct BenchFrame
+{
+  uint64_t timestamp; // NOLINT(build/unsigned)
+  char data[456];
+
+  uint64_t get_timestamp() const { return timestamp; } // NOLINT(build/unsigned)
+  void set_timestamp(uint64_t ts) { timestamp = ts; }  // NOLINT(build/unsigned)
+};
+
+struct BenchElement
+{
+  using FrameType = BenchFrame;
+
+  static const constexpr SourceID::Subsystem subsystem = SourceID::Subsystem::kDetectorReadout;
+  static const constexpr dunedaq::daqdataformats::FragmentType fragment_type =
+    dunedaq::daqdataformats::FragmentType::kUnknown;
+  static const constexpr uint64_t expected_tick_difference = tick_difference; // NOLINT(build/unsigned)
+  static const constexpr size_t fixed_payload_size = sizeof(BenchFrame) * frames_per_element;
+
+  BenchFrame frames[frames_per_element];
+
+  bool operator<(const BenchElement& other) const { return get_timestamp() < other.get_timestamp(); }
+
+  uint64_t get_timestamp() const { return frames[0].timestamp; } // NOLINT(build/unsigned)
+
+  void set_timestamp(uint64_t ts) // NOLINT(build/unsigned)
+  {
+    for (size_t i = 0; i < frames_per_element; ++i) {
+      frames[i].timestamp = ts + i * expected_tick_difference;
+    }
+  }
+
+  void fake_timestamps(uint64_t first_timestamp, uint64_t /*offset*/) { set_timestamp(first_timestamp); } // NOLINT(build/unsigned)
+
+  size_t get_payload_size() const { return fixed_payload_size; }
+  size_t get_num_frames() const { return frames_per_element; }
+  size_t get_frame_size() const { return sizeof(BenchFrame); }
+
+  FrameType* begin() { return &frames[0]; }
+  FrameType* end() { return &frames[frames_per_element]; }
+};
+
+const constexpr uint64_t ticks_per_element = tick_difference * frames_per_element; // NOLINT(build/unsigned)
+
+// Exposes the request path of a handler without conf(), iomanager or a running module.
+// Members conf() would set are given safe values here.
+template<class Handler>
+class BenchHandler : public Handler
+{
+public:
+  using RequestResult = typename Handler::RequestResult;
+
+  template<class LB>
+  BenchHandler(std::shared_ptr<LB>& latency_buffer,
+               std::unique_ptr<FrameErrorRegistry>& error_registry,
+               size_t capacity)
+    : Handler(latency_buffer, error_registry)
+  {
+    this->m_sourceid = SourceID(BenchElement::subsystem, 0);
+    this->m_detid = 0;
+    this->m_warn_about_empty_buffer = false;
+    this->m_buffer_capacity = capacity;
+    this->m_pop_limit_pct = 0.8f;
+    this->m_pop_size_pct = 0.1f;
+    this->m_pop_limit_size = this->m_pop_limit_pct * capacity;
+    this->m_max_requested_elements = capacity;
+    this->m_configured = true;
+  }
+
+  // Same synchronization with cleanup as issue_request(), on the calling thread
+  RequestResult serve(const DataRequest& dr)
+  {
+    {
+      std::unique_lock<std::mutex> lock(this->m_cv_mutex);
+      this->m_cv.wait(lock, [&] { return !this->m_cleanup_requested; });
+      this->m_requests_running++;
+    }
+    this->m_cv.notify_all();
+    auto result = this->data_request(dr);
+    {
+      std::lock_guard<std::mutex> lock(this->m_cv_mutex);
+      this->m_requests_running--;
+    }
+    this->m_cv.notify_all();
+    return result;
+  }
+
+  void release(const void* storage) { this->release_fragment_buffer(storage); }
+};
+
+// Stand-in for the fragment output: accounts for the fragments and drops them
+class FragmentSink
+{
+public:
+  void consume(std::unique_ptr<Fragment> fragment)
+  {
+    if (fragment != nullptr) {
+      m_bytes += fragment->get_size();
+      ++m_fragments;
+    }
+  }
+
+  uint64_t bytes() const { return m_bytes.load(); }         // NOLINT(build/unsigned)
+  uint64_t fragments() const { return m_fragments.load(); } // NOLINT(build/unsigned)
+
+private:
+  std::atomic<uint64_t> m_bytes{ 0 };     // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_fragments{ 0 }; // NOLINT(build/unsigned)
+};
+
+struct RecordedRequest
+{
+  uint64_t trigger_timestamp; // NOLINT(build/unsigned)
+  uint64_t window_begin;      // NOLINT(build/unsigned)
+  uint64_t window_end;        // NOLINT(build/unsigned)
+};
+
+// Request log format: one "trigger_timestamp window_begin window_end" line per request, '#' starts a comment
+std::vector<RecordedRequest>
+read_request_log(const std::string& path)
+{
+  std::vector<RecordedRequest> requests;
+  std::ifstream log(path);
+  std::string line;
+  while (std::getline(log, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream iss(line);
+    RecordedRequest req;
+    if (iss >> req.trigger_timestamp >> req.window_begin >> req.window_end) {
+      requests.push_back(req);
+    }
+  }
+  return requests;
+}
+
+// Options
+std::string buffer_types = "all";
+size_t lb_capacity = 20000;
+double data_rate_khz = 100.0;
+double request_rate_hz = 100.0;
+uint64_t window_before = 10000; // NOLINT(build/unsigned)
+uint64_t window_after = 10000;  // NOLINT(build/unsigned)
+uint64_t latency_mean = 500000; // NOLINT(build/unsigned)
+uint64_t latency_sigma = 100000; // NOLINT(build/unsigned)
+size_t request_threads = 4;
+int runsecs = 10;
+std::string replay_file;
+
+template<class LB, class Handler>
+void
+run_benchmark(const std::string& name)
+{
+  auto latency_buffer = std::make_shared<LB>();
+  latency_buffer->allocate_memory(lb_capacity);
+  std::unique_ptr<FrameErrorRegistry> error_registry = std::make_unique<FrameErrorRegistry>();
+  BenchHandler<Handler> handler(latency_buffer, error_registry, lb_capacity);
+
+  std::atomic<bool> marker{ true };
+  std::atomic<uint64_t> newest_ts{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> num_dropped{ 0 }; // NOLINT(build/unsigned)
+
+  // Producer: writes elements at the target rate and triggers cleanups like a readout thread would
+  auto producer = std::thread([&]() {
+    RateLimiter rl(data_rate_khz);
+    uint64_t ts = ticks_per_element; // NOLINT(build/unsigned)
+    uint64_t written = 0;            // NOLINT(build/unsigned)
+    while (marker) {
+      BenchElement element;
+      element.set_timestamp(ts);
+      if (latency_buffer->write(std::move(element))) {
+        newest_ts = ts;
+      } else {
+        ++num_dropped;
+      }
+      ts += ticks_per_element;
+      if (++written % 1000 == 0) {
+        handler.cleanup_check();
+      }
+      rl.limit();
+    }
+  });
+
+  FragmentSink sink;
+  LatencyHistogram response_time; // microseconds, from request arrival to fragment handed to the sink
+  std::map<std::string, uint64_t> result_codes; // NOLINT(build/unsigned)
+  std::mutex result_codes_lock;
+  boost::asio::thread_pool pool(request_threads);
+  uint64_t trigger_number = 0; // NOLINT(build/unsigned)
+
+  auto fire = [&](uint64_t trigger_ts, uint64_t window_begin, uint64_t window_end) { // NOLINT(build/unsigned)
+    DataRequest dr;
+    dr.trigger_number = ++trigger_number;
+    dr.sequence_number = 0;
+    dr.run_number = 1;
+    dr.trigger_timestamp = trigger_ts;
+    dr.request_information.window_begin = window_begin;
+    dr.request_information.window_end = window_end;
+    dr.data_destination = "sink";
+    auto t_arrived = std::chrono::steady_clock::now();
+    boost::asio::post(pool, [&, dr, t_arrived]() {
+      auto result = handler.serve(dr);
+      const void* storage = result.fragment ? result.fragment->get_storage_location() : nullptr;
+      sink.consume(std::move(result.fragment));
+      handler.release(storage);
+      response_time.record(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_arrived).count());
+      std::ostringstream code;
+      code << result.result_code;
+      std::lock_guard<std::mutex> lock(result_codes_lock);
+      ++result_codes[code.str()];
+    });
+  };
+
+  // Wait until the buffer holds more than the trigger latency
+  while (newest_ts.load() < latency_mean + latency_sigma * 3 + window_before) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  auto t_start = std::chrono::steady_clock::now();
+  auto t_end = t_start + std::chrono::seconds(runsecs);
+  if (replay_file.empty()) {
+    // Triggers arrive at a fixed rate, with a normally distributed latency behind the newest data
+    std::mt19937 mt(0);
+    std::normal_distribution<> latency(static_cast<double>(latency_mean), static_cast<double>(latency_sigma));
+    RateLimiter rl(request_rate_hz / 1000.);
+    while (std::chrono::steady_clock::now() < t_end) {
+      uint64_t now_ts = newest_ts.load(); // NOLINT(build/unsigned)
+      uint64_t trigger_latency = static_cast<uint64_t>(std::max(latency(mt), 0.)); // NOLINT(build/unsigned)
+      uint64_t trigger_ts = now_ts - std::min<uint64_t>(trigger_latency, now_ts - window_before); // NOLINT(build/unsigned)
+      fire(trigger_ts, trigger_ts - window_before, trigger_ts + window_after);
+      rl.limit();
+    }
+  } else {
+    // Recorded requests are shifted onto the synthetic timeline and fired once the data after the
+    // trigger is latency_mean ticks old, which keeps the spacing of the original log
+    auto requests = read_request_log(replay_file);
+    if (requests.empty()) {
+      TLOG() << "No request found in " << replay_file;
+    } else {
+      // Modular shift, so that it works in both directions: timestamps + offset wrap back into range.
+      // All of this is integer arithmetic, doubles cannot hold real timestamps exactly.
+      uint64_t offset = newest_ts.load() + latency_mean - requests.front().trigger_timestamp; // NOLINT(build/unsigned)
+      for (const auto& req : requests) {
+        while (marker && newest_ts.load() < req.trigger_timestamp + offset + latency_mean) {
+          std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        fire(req.trigger_timestamp + offset, req.window_begin + offset, req.window_end + offset);
+      }
+    }
+  }
+  pool.join();
+  auto elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+  marker = false;
+  producer.join();
+
+  auto stats = response_time.snapshot_and_reset();
+  TLOG() << "=== " << name << " ===";
+  TLOG() << "  Requests served: " << stats.count << " in " << elapsed_s << " [s] -> " << stats.count / elapsed_s
+         << " [req/s], " << sink.bytes() / elapsed_s / 1e6 << " [MB/s], " << sink.fragments() << " fragments";
+  TLOG() << "  Response time [us]: p50=" << stats.p50 << " p90=" << stats.p90 << " p99=" << stats.p99
+         << " p99.9=" << stats.p999 << " max=" << stats.max;
+  for (const auto& [code, count] : result_codes) {
+    TLOG() << "  Result " << code << ": " << count;
+  }
+  if (num_dropped.load() > 0) {
+    TLOG() << "  Elements dropped on a full buffer: " << num_dropped.load();
+  }
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+  CLI::App app{ "datahandlinglibs_test_request_replay" };
+  app.add_option("-b,--buffers", buffer_types, "Buffers to benchmark: binarysearch, fixedrate, skiplist or all.");
+  app.add_option("-c,--capacity", lb_capacity, "Capacity of the latency buffers in elements.");
+  app.add_option("--data-rate", data_rate_khz, "Element rate of the producer in kHz.");
+  app.add_option("--request-rate", request_rate_hz, "Rate of data requests in Hz.");
+  app.add_option("--window-before", window_before, "Window ticks before the trigger timestamp.");
+  app.add_option("--window-after", window_after, "Window ticks after the trigger timestamp.");
+  app.add_option("--latency-mean", latency_mean, "Mean trigger latency behind the newest data, in ticks.");
+  app.add_option("--latency-sigma", latency_sigma, "Standard deviation of the trigger latency, in ticks.");
+  app.add_option("-t,--threads", request_threads, "Number of request handler threads.");
+  app.add_option("-s,--seconds", runsecs, "Duration of each benchmark in seconds.");
+  app.add_option("--replay", replay_file, "Request log to replay instead of synthetic requests.");
+  CLI11_PARSE(app, argc, argv);
+
+  if (buffer_types == "all" || buffer_types == "binarysearch") {
+    run_benchmark<BinarySearchQueueModel<BenchElement>,
+                  DefaultRequestHandlerModel<BenchElement, BinarySearchQueueModel<BenchElement>>>("BinarySearchQueueModel");
+  }
+  if (buffer_types == "all" || buffer_types == "fixedrate") {
+    run_benchmark<FixedRateQueueModel<BenchElement>,
+                  DefaultRequestHandlerModel<BenchElement, FixedRateQueueModel<BenchElement>>>("FixedRateQueueModel");
+  }
+  if (buffer_types == "all" || buffer_types == "skiplist") {
+    run_benchmark<SkipListLatencyBufferModel<BenchElement>, DefaultSkipListRequestHandler<BenchElement>>(
+      "SkipListLatencyBufferModel");
+  }
+
+  TLOG() << "Exiting.";
+  return 0;
+}
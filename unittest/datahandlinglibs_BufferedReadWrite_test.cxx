@@ -14,15 +14,83 @@
 #include "boost/test/unit_test.hpp"
 
 #include "logging/Logging.hpp"
+#include "datahandlinglibs/utils/AdcDeltaCodec.hpp"
 #include "datahandlinglibs/utils/BufferedFileReader.hpp"
 #include "datahandlinglibs/utils/BufferedFileWriter.hpp"
+#include "datahandlinglibs/utils/DoubleBufferedFileWriter.hpp"
+#include "datahandlinglibs/utils/UringFileWriter.hpp"
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
 #include <string>
 #include <vector>
 
 using namespace dunedaq::datahandlinglibs;
 
+// Frame with 14-bit ADC values packed back to back, as in the detector formats
+struct TestAdcFrame
+{
+  uint64_t timestamp;          // NOLINT(build/unsigned)
+  uint8_t packed[14 * 16 * 4]; // 16 channels x 4 samples // NOLINT(build/unsigned)
+};
+
+namespace dunedaq::datahandlinglibs {
+template<>
+struct AdcCodecTraits<TestAdcFrame>
+{
+  static constexpr std::size_t num_channels = 16;
+  static constexpr std::size_t num_samples = 4;
+  static constexpr std::size_t rest_size = sizeof(uint64_t); // NOLINT(build/unsigned)
+
+  static void unpack(const TestAdcFrame& frame, uint16_t* adcs, char* rest) // NOLINT(build/unsigned)
+  {
+    std::memcpy(rest, &frame.timestamp, rest_size);
+    for (std::size_t i = 0; i < num_channels * num_samples; ++i) {
+      uint16_t value = 0; // NOLINT(build/unsigned)
+      for (std::size_t b = 0; b < 14; ++b) {
+        auto bit = i * 14 + b;
+        value |= ((frame.packed[bit / 8] >> (bit % 8)) & 1) << b;
+      }
+      adcs[i] = value;
+    }
+  }
+
+  static void pack(const uint16_t* adcs, const char* rest, TestAdcFrame& frame) // NOLINT(build/unsigned)
+  {
+    std::memcpy(&frame.timestamp, rest, rest_size);
+    std::memset(frame.packed, 0, sizeof(frame.packed));
+    for (std::size_t i = 0; i < num_channels * num_samples; ++i) {
+      for (std::size_t b = 0; b < 14; ++b) {
+        auto bit = i * 14 + b;
+        frame.packed[bit / 8] |= ((adcs[i] >> b) & 1) << (bit % 8);
+      }
+    }
+  }
+};
+} // namespace dunedaq::datahandlinglibs
+
+std::vector<TestAdcFrame>
+make_adc_frames(std::size_t count)
+{
+  std::mt19937 generator(42);
+  std::normal_distribution<double> noise(0., 3.);
+  std::vector<uint16_t> adcs(16 * 4); // NOLINT(build/unsigned)
+  std::vector<TestAdcFrame> frames(count);
+  std::vector<char> rest(sizeof(uint64_t)); // NOLINT(build/unsigned)
+  for (std::size_t f = 0; f < count; ++f) {
+    for (std::size_t i = 0; i < adcs.size(); ++i) {
+      adcs[i] = static_cast<uint16_t>(std::max(0., 900. + 50. * (i % 16) + noise(generator))); // NOLINT(build/unsigned)
+    }
+    uint64_t timestamp = 32 * 4 * f; // NOLINT(build/unsigned)
+    std::memcpy(rest.data(), &timestamp, sizeof(timestamp));
+    AdcCodecTraits<TestAdcFrame>::pack(adcs.data(), rest.data(), frames[f]);
+  }
+  return frames;
+}
+
 BOOST_AUTO_TEST_SUITE(datahandlinglibs_BufferedReadWrite_test)
 
 void
@@ -96,6 +164,36 @@ BOOST_AUTO_TEST_CASE(BufferedReadWrite_zstd)
   test_read_write(writer, reader, numbers_to_write);
 }
 
+BOOST_AUTO_TEST_CASE(BufferedReadWrite_zstd_parallel)
+{
+  TLOG() << "Testing parallel zstd compression" << std::endl;
+  remove("test.out");
+  BufferedFileWriter writer;
+  writer.set_parallel_compression(4, 1024 * 1024 + 12); // Blocks do not end on element boundaries
+  writer.open("test.out", 4096, "zstd-parallel");
+  BufferedFileReader<int> reader;
+  uint numbers_to_write = 4096 * 4096;
+
+  std::vector<int> numbers(numbers_to_write / sizeof(int));
+  for (uint i = 0; i < numbers.size(); ++i) {
+    numbers[i] = i;
+    BOOST_REQUIRE(writer.write(reinterpret_cast<char*>(&i), sizeof(i)));
+  }
+  writer.close();
+
+  reader.open("test.out", 4096, "zstd-parallel");
+  int read_value;
+  for (uint i = 0; i < numbers.size(); ++i) {
+    BOOST_REQUIRE(reader.read(read_value));
+    BOOST_REQUIRE_EQUAL(read_value, numbers[i]);
+  }
+  BOOST_REQUIRE(!reader.read(read_value));
+  reader.close();
+
+  remove("test.out");
+  remove("test.out.idx");
+}
+
 BOOST_AUTO_TEST_CASE(BufferedReadWrite_lzma)
 {
   TLOG() << "Testing lzma compression" << std::endl;
@@ -122,6 +220,215 @@ BOOST_AUTO_TEST_CASE(BufferedReadWrite_zlib)
   test_read_write(writer, reader, numbers_to_write);
 }
 
+void
+test_seek(const std::string& compression_algorithm)
+{
+  TLOG() << "Testing timestamp seek with compression " << compression_algorithm << std::endl;
+  remove("test.out");
+  BufferedFileWriter writer;
+  writer.set_parallel_compression(2, 64 * 1024);
+  writer.set_timestamp_index(sizeof(int), 0, 4096);
+  writer.open("test.out", 4096, compression_algorithm);
+  int numbers = 1024 * 1024;
+  for (int i = 0; i < numbers; ++i) {
+    BOOST_REQUIRE(writer.write(reinterpret_cast<char*>(&i), sizeof(i), i));
+  }
+  writer.close();
+
+  BufferedFileReader<int> reader("test.out", 4096, compression_algorithm);
+  int value;
+  for (int target : { 700000, 5, 0, 123457, numbers - 1 }) {
+    BOOST_REQUIRE(reader.seek(target));
+    BOOST_REQUIRE(reader.read(value));
+    // The reader starts at most one index interval before the timestamp
+    BOOST_REQUIRE(value <= target && target - value < 4096 / static_cast<int>(sizeof(int)));
+    while (value < target) {
+      BOOST_REQUIRE(reader.read(value));
+    }
+    BOOST_REQUIRE_EQUAL(value, target);
+  }
+  reader.close();
+
+  remove("test.out");
+  remove("test.out.idx");
+  remove("test.out.tsidx");
+}
+
+BOOST_AUTO_TEST_CASE(BufferedReadWrite_seek)
+{
+  test_seek("None");
+  test_seek("zstd");
+  test_seek("zstd-parallel");
+
+  TLOG() << "Testing seek without a timestamp index" << std::endl;
+  remove("test.out");
+  {
+    BufferedFileWriter writer("test.out", 4096);
+    int number = 42;
+    BOOST_REQUIRE(writer.write(reinterpret_cast<char*>(&number), sizeof(number), number));
+  }
+  BufferedFileReader<int> reader("test.out", 4096);
+  BOOST_REQUIRE(!reader.seek(42));
+  reader.close();
+  remove("test.out");
+}
+
+void
+test_staged(const std::string& compression_algorithm)
+{
+  TLOG() << "Testing staged writes with " << compression_algorithm << std::endl;
+  remove("test.out");
+  const int numbers_to_write = 300000;
+  BufferedFileWriter writer;
+  writer.set_staging_buffers(3);
+  writer.open("test.out", 4 * 4096, compression_algorithm, true);
+  for (int i = 0; i < numbers_to_write; ++i) {
+    BOOST_REQUIRE(writer.write(reinterpret_cast<char*>(&i), sizeof(i))); // NOLINT
+    if (i == numbers_to_write / 3) {
+      // Padded and truncated, then completed by the following writes
+      writer.flush();
+    }
+  }
+  writer.close();
+
+  BufferedFileReader<int> reader("test.out", 4096, compression_algorithm);
+  int value;
+  for (int i = 0; i < numbers_to_write; ++i) {
+    BOOST_REQUIRE(reader.read(value));
+    BOOST_REQUIRE_EQUAL(value, i);
+  }
+  BOOST_REQUIRE(!reader.read(value));
+  reader.close();
+  remove("test.out");
+  remove((std::string("test.out") + s_block_index_suffix).c_str());
+}
+
+BOOST_AUTO_TEST_CASE(BufferedReadWrite_staged)
+{
+  test_staged("None");
+  test_staged("zstd");
+  test_staged("zstd-parallel");
+}
+
+BOOST_AUTO_TEST_CASE(BufferedReadWrite_double_buffered)
+{
+  TLOG() << "Testing the double buffered writer" << std::endl;
+  remove("test.out");
+  const int numbers_to_write = 100000; // Not a multiple of the batch size, leaves a tail at close
+  {
+    DoubleBufferedFileWriter writer;
+    writer.set_timestamp_index(sizeof(int), 0, 4096);
+    writer.open("test.out", 3 * 4096, false);
+    for (int i = 0; i < numbers_to_write; ++i) {
+      std::memcpy(writer.reserve(sizeof(i)), &i, sizeof(i));
+      writer.commit(sizeof(i), i);
+      if (i % 10000 == 0) {
+        writer.hand_off();
+      }
+    }
+    writer.close();
+    BOOST_REQUIRE_EQUAL(writer.failed_writes(), 0);
+  }
+
+  BufferedFileReader<int> reader("test.out", 4096);
+  int value;
+  for (int i = 0; i < numbers_to_write; ++i) {
+    BOOST_REQUIRE(reader.read(value));
+    BOOST_REQUIRE_EQUAL(value, i);
+  }
+  BOOST_REQUIRE(!reader.read(value));
+  BOOST_REQUIRE(reader.seek(50000));
+  BOOST_REQUIRE(reader.read(value));
+  BOOST_REQUIRE(value <= 50000 && value > 50000 - 1024);
+  reader.close();
+  remove("test.out");
+  remove((std::string("test.out") + TimestampIndex::s_suffix).c_str());
+}
+
+BOOST_AUTO_TEST_CASE(BufferedReadWrite_adc_codec)
+{
+  TLOG() << "Testing the ADC delta codec" << std::endl;
+  auto codec = std::make_shared<AdcDeltaCodec<TestAdcFrame>>();
+  auto frames = make_adc_frames(1000);
+  const char* data = reinterpret_cast<const char*>(frames.data()); // NOLINT
+
+  // Full range values and a block ending in an incomplete frame round-trip as well
+  frames[3].packed[10] = 0xFF;
+  auto size = frames.size() * sizeof(TestAdcFrame) - 100;
+  auto encoded = codec->encode(data, size);
+  BOOST_REQUIRE(encoded.size() < size / 2);
+  std::vector<char> decoded;
+  BOOST_REQUIRE(codec->decode(encoded.data(), encoded.size(), decoded, size));
+  BOOST_REQUIRE(std::memcmp(decoded.data(), data, size) == 0);
+  BOOST_REQUIRE(!codec->decode(encoded.data(), encoded.size() - 1, decoded, size));
+
+  remove("test.out");
+  BufferedFileWriter writer;
+  writer.set_codec(codec);
+  writer.set_parallel_compression(2, 100 * sizeof(TestAdcFrame) + 1);
+  writer.open("test.out", 4096, "adc-delta", false);
+  for (auto& frame : frames) {
+    BOOST_REQUIRE(writer.write(reinterpret_cast<char*>(&frame), sizeof(frame))); // NOLINT
+  }
+  writer.close();
+
+  BufferedFileReader<TestAdcFrame> reader;
+  reader.set_codec(codec);
+  reader.open("test.out", 4096, "adc-delta");
+  TestAdcFrame frame;
+  for (auto& expected : frames) {
+    BOOST_REQUIRE(reader.read(frame));
+    BOOST_REQUIRE(std::memcmp(&frame, &expected, sizeof(frame)) == 0);
+  }
+  BOOST_REQUIRE(!reader.read(frame));
+  reader.close();
+  remove("test.out");
+  remove((std::string("test.out") + s_block_index_suffix).c_str());
+}
+
+BOOST_AUTO_TEST_CASE(BufferedReadWrite_batch_and_mmap)
+{
+  TLOG() << "Testing batch reads and the mmap mode" << std::endl;
+  remove("test.out");
+  const int numbers_to_write = 100000;
+  {
+    BufferedFileWriter writer;
+    writer.set_timestamp_index(sizeof(int), 0, 4096);
+    writer.open("test.out", 4096, "None", false);
+    for (int i = 0; i < numbers_to_write; ++i) {
+      BOOST_REQUIRE(writer.write(reinterpret_cast<char*>(&i), sizeof(i), i)); // NOLINT
+    }
+  }
+
+  std::vector<int> batch(7000);
+  for (bool use_mmap : { false, true }) {
+    BufferedFileReader<int> reader;
+    reader.set_mmap(use_mmap);
+    reader.open("test.out", 4096);
+    int expected = 0;
+    size_t count;
+    while ((count = reader.read_n(batch.data(), batch.size())) > 0) {
+      for (size_t i = 0; i < count; ++i) {
+        BOOST_REQUIRE_EQUAL(batch[i], expected++);
+      }
+    }
+    BOOST_REQUIRE_EQUAL(expected, numbers_to_write);
+
+    BOOST_REQUIRE(reader.seek(50000));
+    const int* view = reader.read_view(10, count);
+    if (use_mmap) {
+      BOOST_REQUIRE_EQUAL(count, 10);
+      BOOST_REQUIRE(view[0] <= 50000 && view[0] > 50000 - 1024);
+      BOOST_REQUIRE_EQUAL(view[9], view[0] + 9);
+    } else {
+      BOOST_REQUIRE(view == nullptr && count == 0);
+    }
+    reader.close();
+  }
+  remove("test.out");
+  remove((std::string("test.out") + TimestampIndex::s_suffix).c_str());
+}
+
 BOOST_AUTO_TEST_CASE(BufferedReadWrite_not_opened)
 {
   TLOG() << "Try to read and write on uninitialized instances" << std::endl;
@@ -167,4 +474,49 @@ BOOST_AUTO_TEST_CASE(BufferedReadWrite_destructor)
   remove("test.out");
 }
 
+BOOST_AUTO_TEST_CASE(BufferedReadWrite_uring_writer)
+{
+  TLOG() << "Testing the io_uring writer with short writes" << std::endl;
+  std::vector<char> region(64 * 1024);
+  std::mt19937 generator(42);
+  for (auto& byte : region) {
+    byte = static_cast<char>(generator());
+  }
+  std::vector<std::string> files = { "test_stripe0.out", "test_stripe1.out" };
+  std::vector<int> fds;
+  for (const auto& file : files) {
+    fds.push_back(::open(file.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644));
+    BOOST_REQUIRE(fds.back() != -1);
+  }
+
+  // Writes are capped below the chunk and stripe sizes, every chunk completes in several pieces
+  const std::size_t chunk_size = 4096;
+  const std::size_t stripe_size = 3000;
+  UringFileWriter writer;
+  BOOST_REQUIRE(writer.open(fds, stripe_size, 4, region.data(), region.size()));
+  writer.set_max_write_size(1000);
+  for (std::size_t offset = 0; offset < region.size(); offset += chunk_size) {
+    BOOST_REQUIRE(writer.write(region.data() + offset, chunk_size));
+  }
+  BOOST_REQUIRE(writer.drain());
+  BOOST_REQUIRE_EQUAL(writer.failed_writes(), 0);
+  BOOST_REQUIRE_EQUAL(writer.file_offset(), region.size());
+  writer.close();
+  for (auto fd : fds) {
+    ::close(fd);
+  }
+
+  StripeManifest manifest;
+  manifest.stripe_size = stripe_size;
+  manifest.files = files;
+  StripedFileSource source(manifest);
+  std::vector<char> read_back(region.size() + 1);
+  BOOST_REQUIRE_EQUAL(source.read(read_back.data(), read_back.size()), static_cast<std::streamsize>(region.size()));
+  read_back.resize(region.size());
+  BOOST_REQUIRE(read_back == region);
+  for (const auto& file : files) {
+    remove(file.c_str());
+  }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
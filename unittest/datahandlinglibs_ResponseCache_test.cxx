@@ -0,0 +1,129 @@
+/**
+ * @file datahandlinglibs_ResponseCache_test.cxx Unit Tests for the ResponseCache
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+/**
+ * @brief Name of this test module
+ */
+#define BOOST_TEST_MODULE datahandlinglibs_ResponseCache_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include "daqdataformats/Fragment.hpp"
+#include "datahandlinglibs/utils/ResponseCache.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace dunedaq::datahandlinglibs;
+using dunedaq::daqdataformats::Fragment;
+
+BOOST_AUTO_TEST_SUITE(datahandlinglibs_ResponseCache_test)
+
+namespace {
+
+std::unique_ptr<Fragment>
+make_fragment(uint64_t trigger_number, uint16_t sequence_number, std::vector<char>& payload) // NOLINT(build/unsigned)
+{
+  std::vector<std::pair<void*, size_t>> pieces{ { payload.data(), payload.size() } };
+  auto fragment = std::make_unique<Fragment>(pieces);
+  auto header = fragment->get_header();
+  header.trigger_number = trigger_number;
+  header.sequence_number = sequence_number;
+  header.trigger_timestamp = 1000;
+  header.window_begin = 900;
+  header.window_end = 1100;
+  header.run_number = 42;
+  header.element_id.id = 7;
+  header.fragment_type = 3;
+  fragment->set_header_fields(header);
+  return fragment;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(ResponseCache_disabled)
+{
+  ResponseCache cache;
+  BOOST_REQUIRE(!cache.is_enabled());
+  char data[16] = {};
+  cache.insert({ 1, 0, 900, 1100 }, data, sizeof(data));
+  BOOST_REQUIRE(cache.find({ 1, 0, 900, 1100 }) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(ResponseCache_round_trip)
+{
+  ResponseCache cache;
+  cache.configure(4, 0, std::chrono::milliseconds(1000));
+  std::vector<char> payload(1000);
+  for (size_t i = 0; i < payload.size(); ++i) {
+    payload[i] = static_cast<char>(i);
+  }
+  auto original = make_fragment(12, 1, payload);
+  ResponseCache::Key key{ 12, 1, 900, 1100 };
+  cache.insert(key, original->get_storage_location(), original->get_size());
+
+  BOOST_REQUIRE(cache.find({ 12, 0, 900, 1100 }) == nullptr);
+  auto response = cache.find(key);
+  BOOST_REQUIRE(response != nullptr);
+  BOOST_REQUIRE_EQUAL(response->size(), original->get_size());
+
+  // Rebuilt as in DefaultRequestHandlerModel::send_cached_response
+  Fragment copy(const_cast<char*>(response->data()), Fragment::BufferAdoptionMode::kCopyFromBuffer); // NOLINT
+  auto expected = original->get_header();
+  auto header = copy.get_header();
+  BOOST_REQUIRE_EQUAL(header.size, expected.size);
+  BOOST_REQUIRE_EQUAL(header.trigger_number, expected.trigger_number);
+  BOOST_REQUIRE_EQUAL(header.sequence_number, expected.sequence_number);
+  BOOST_REQUIRE_EQUAL(header.trigger_timestamp, expected.trigger_timestamp);
+  BOOST_REQUIRE_EQUAL(header.window_begin, expected.window_begin);
+  BOOST_REQUIRE_EQUAL(header.window_end, expected.window_end);
+  BOOST_REQUIRE_EQUAL(header.run_number, expected.run_number);
+  BOOST_REQUIRE_EQUAL(header.fragment_type, expected.fragment_type);
+  BOOST_REQUIRE(header.element_id == expected.element_id);
+  BOOST_REQUIRE_EQUAL(copy.get_data_size(), payload.size());
+  BOOST_REQUIRE(std::memcmp(copy.get_data(), payload.data(), payload.size()) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(ResponseCache_eviction)
+{
+  ResponseCache cache;
+  cache.configure(2, 0, std::chrono::milliseconds(1000));
+  char data[16] = {};
+  cache.insert({ 1, 0, 0, 10 }, data, sizeof(data));
+  cache.insert({ 2, 0, 0, 10 }, data, sizeof(data));
+  // Using the first entry makes the second one the least recently used
+  BOOST_REQUIRE(cache.find({ 1, 0, 0, 10 }) != nullptr);
+  cache.insert({ 3, 0, 0, 10 }, data, sizeof(data));
+  BOOST_REQUIRE(cache.find({ 1, 0, 0, 10 }) != nullptr);
+  BOOST_REQUIRE(cache.find({ 2, 0, 0, 10 }) == nullptr);
+  BOOST_REQUIRE(cache.find({ 3, 0, 0, 10 }) != nullptr);
+
+  // Byte budget, the first entry is the least recently used now
+  cache.configure(4, 2 * sizeof(data), std::chrono::milliseconds(1000));
+  cache.insert({ 4, 0, 0, 10 }, data, sizeof(data));
+  BOOST_REQUIRE(cache.find({ 4, 0, 0, 10 }) != nullptr);
+  BOOST_REQUIRE(cache.find({ 3, 0, 0, 10 }) != nullptr);
+  BOOST_REQUIRE(cache.find({ 1, 0, 0, 10 }) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(ResponseCache_ttl)
+{
+  ResponseCache cache;
+  cache.configure(4, 0, std::chrono::milliseconds(10));
+  char data[16] = {};
+  cache.insert({ 1, 0, 0, 10 }, data, sizeof(data));
+  BOOST_REQUIRE(cache.find({ 1, 0, 0, 10 }) != nullptr);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  BOOST_REQUIRE(cache.find({ 1, 0, 0, 10 }) == nullptr);
+}
+
+BOOST_AUTO_TEST_SUITE_END()